@@ -1,43 +1,47 @@
-#include <stdio.h>
 #include <stdlib.h>
-#include <assert.h>
 
 #include "mapper/mapper.h"
 
+/**
+ * NROM: 16 or 32 KB of PRG ROM and 8 KB of CHR, nothing switches
+ *
+ * Reference: http://wiki.nesdev.com/w/index.php/NROM
+ */
+
 struct Mapper {
   Cartridge * cartridge;
 };
 
-Mapper * mapper_create(Cartridge * cartridge) {
+static Mapper * nrom_create(Cartridge * cartridge, MapperBanks * banks) {
   Mapper * mapper = malloc(sizeof(Mapper));
+  if (!mapper) {
+    return NULL;
+  }
   mapper->cartridge = cartridge;
+
+  // A 16 KB ROM is mirrored into $C000-$FFFF
+  int prg_size = cartridge->prg_rom_size << 14;
+  for (int i = 0; i < MAPPER_PRG_WINDOWS; ++i) {
+    banks->prg[i] = cartridge->prg_rom + (i * MAPPER_PRG_WINDOW_SIZE) % prg_size;
+  }
+  mapper_banks_chr(banks, 0, MAPPER_CHR_WINDOWS, cartridge->chr_rom);
+
   return mapper;
 }
 
-void mapper_destroy(Mapper * mapper) {
+static void nrom_destroy(Mapper * mapper) {
   free(mapper);
 }
 
-void mapper_write(Mapper * mapper, uint16_t addr, uint8_t val) {
-  // TODO: CHR_RAM
-  Cartridge * cartridge = mapper->cartridge;
-  if (addr >= 0x6000 && addr <= 0x7FFF) {
-    cartridge->save_ram[addr - 0x6000] = val;
-  } else {
-    assert(false);
-  }
+static void nrom_write(Mapper * mapper, uint16_t addr, uint8_t val) {
+  (void)mapper;
+  (void)addr;
+  (void)val;
 }
 
-uint8_t mapper_read(Mapper * mapper, uint16_t addr) {
-  // TODO: CHR_RAM
-  Cartridge * cartridge = mapper->cartridge;
-  if (addr >= 0x6000 && addr <= 0x7FFF) {
-    return cartridge->save_ram[addr - 0x6000];
-  } else if (addr >= 0x8000) {
-    return cartridge->prg_rom[(addr - 0x8000) % (cartridge->prg_rom_size << 14)];
-  } else {
-    assert(false);
-  }
-
-  return 0;
-}
+MAPPER_INTERFACE(0) = {
+  .abi = MAPPER_ABI,
+  .create = nrom_create,
+  .destroy = nrom_destroy,
+  .write = nrom_write,
+};
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+
+#include "mapper/mapper.h"
+
+/**
+ * MMC1 (SxROM): registers are loaded one bit at a time through a shift
+ * register, the fifth write to $8000-$FFFF stores the value in the
+ * register selected by bits 13-14 of its address.
+ *
+ * Reference: http://wiki.nesdev.com/w/index.php/MMC1
+ */
+
+struct Mapper {
+  Cartridge * cartridge;
+  MapperBanks * banks;
+
+  uint8_t shift;
+  uint8_t shift_count;
+
+  uint8_t control;
+  uint8_t chr0;
+  uint8_t chr1;
+  uint8_t prg;
+};
+
+static uint8_t * mmc1_chr_bank(Mapper * mapper, int bank) {
+  Cartridge * cartridge = mapper->cartridge;
+  int banks = cartridge->chr_rom_size * 2;
+  return cartridge->chr_rom + ((bank % banks) << 12);
+}
+
+static uint8_t * mmc1_prg_bank(Mapper * mapper, int bank) {
+  Cartridge * cartridge = mapper->cartridge;
+  return cartridge->prg_rom + ((bank % cartridge->prg_rom_size) << 14);
+}
+
+static void mmc1_update(Mapper * mapper) {
+  MapperBanks * banks = mapper->banks;
+
+  static const Mirror mirrors[] = {
+    MIRROR_SINGLE_LOWER, MIRROR_SINGLE_UPPER, MIRROR_VERTICAL, MIRROR_HORIZONTAL
+  };
+  banks->mirror = mirrors[mapper->control & 0x03];
+
+  int prg = mapper->prg & 0x0F;
+  switch ((mapper->control >> 2) & 0x03) {
+  case 0:
+  case 1:
+    // 32 KB, ignoring the low bit
+    mapper_banks_prg(banks, 0, 2, mmc1_prg_bank(mapper, prg & ~1));
+    mapper_banks_prg(banks, 2, 2, mmc1_prg_bank(mapper, prg | 1));
+    break;
+  case 2:
+    // First bank fixed at $8000
+    mapper_banks_prg(banks, 0, 2, mmc1_prg_bank(mapper, 0));
+    mapper_banks_prg(banks, 2, 2, mmc1_prg_bank(mapper, prg));
+    break;
+  case 3:
+    // Last bank fixed at $C000
+    mapper_banks_prg(banks, 0, 2, mmc1_prg_bank(mapper, prg));
+    mapper_banks_prg(banks, 2, 2, mmc1_prg_bank(mapper, mapper->cartridge->prg_rom_size - 1));
+    break;
+  }
+
+  if (mapper->control & 0x10) {
+    mapper_banks_chr(banks, 0, 4, mmc1_chr_bank(mapper, mapper->chr0));
+    mapper_banks_chr(banks, 4, 4, mmc1_chr_bank(mapper, mapper->chr1));
+  } else {
+    mapper_banks_chr(banks, 0, 4, mmc1_chr_bank(mapper, mapper->chr0 & ~1));
+    mapper_banks_chr(banks, 4, 4, mmc1_chr_bank(mapper, mapper->chr0 | 1));
+  }
+
+  // Bit 4 of the PRG register disables PRG RAM
+  banks->prg_ram = (mapper->prg & 0x10) ? NULL : mapper->cartridge->save_ram;
+
+  banks->changed(banks);
+}
+
+static Mapper * mmc1_create(Cartridge * cartridge, MapperBanks * banks) {
+  Mapper * mapper = calloc(1, sizeof(Mapper));
+  if (!mapper) {
+    return NULL;
+  }
+  mapper->cartridge = cartridge;
+  mapper->banks = banks;
+
+  // Power on with the last bank fixed at $C000
+  mapper->control = 0x0C;
+  mmc1_update(mapper);
+  return mapper;
+}
+
+static void mmc1_destroy(Mapper * mapper) {
+  free(mapper);
+}
+
+static void mmc1_write(Mapper * mapper, uint16_t addr, uint8_t val) {
+  if (addr < 0x8000) {
+    return;
+  }
+
+  // Bit 7 resets the shift register
+  if (val & 0x80) {
+    mapper->shift = 0;
+    mapper->shift_count = 0;
+    mapper->control |= 0x0C;
+    mmc1_update(mapper);
+    return;
+  }
+
+  mapper->shift |= (val & 1) << mapper->shift_count;
+  if (++mapper->shift_count < 5) {
+    return;
+  }
+
+  switch ((addr >> 13) & 0x03) {
+  case 0: mapper->control = mapper->shift; break;
+  case 1: mapper->chr0 = mapper->shift; break;
+  case 2: mapper->chr1 = mapper->shift; break;
+  case 3: mapper->prg = mapper->shift; break;
+  }
+
+  mapper->shift = 0;
+  mapper->shift_count = 0;
+  mmc1_update(mapper);
+}
+
+MAPPER_INTERFACE(1) = {
+  .abi = MAPPER_ABI,
+  .create = mmc1_create,
+  .destroy = mmc1_destroy,
+  .write = mmc1_write,
+};
@@ -0,0 +1,53 @@
+#include <stdlib.h>
+
+#include "mapper/mapper.h"
+
+/**
+ * UxROM: a switchable 16 KB PRG bank at $8000, the last bank fixed at $C000
+ * and 8 KB of CHR RAM. Any write to $8000-$FFFF selects the bank.
+ *
+ * Reference: http://wiki.nesdev.com/w/index.php/UxROM
+ */
+
+struct Mapper {
+  Cartridge * cartridge;
+  MapperBanks * banks;
+};
+
+static Mapper * uxrom_create(Cartridge * cartridge, MapperBanks * banks) {
+  Mapper * mapper = malloc(sizeof(Mapper));
+  if (!mapper) {
+    return NULL;
+  }
+  mapper->cartridge = cartridge;
+  mapper->banks = banks;
+
+  uint8_t * last = cartridge->prg_rom + ((cartridge->prg_rom_size - 1) << 14);
+  mapper_banks_prg(banks, 0, 2, cartridge->prg_rom);
+  mapper_banks_prg(banks, 2, 2, last);
+  mapper_banks_chr(banks, 0, MAPPER_CHR_WINDOWS, cartridge->chr_rom);
+
+  return mapper;
+}
+
+static void uxrom_destroy(Mapper * mapper) {
+  free(mapper);
+}
+
+static void uxrom_write(Mapper * mapper, uint16_t addr, uint8_t val) {
+  if (addr < 0x8000) {
+    return;
+  }
+
+  Cartridge * cartridge = mapper->cartridge;
+  int bank = val % cartridge->prg_rom_size;
+  mapper_banks_prg(mapper->banks, 0, 2, cartridge->prg_rom + (bank << 14));
+  mapper->banks->changed(mapper->banks);
+}
+
+MAPPER_INTERFACE(2) = {
+  .abi = MAPPER_ABI,
+  .create = uxrom_create,
+  .destroy = uxrom_destroy,
+  .write = uxrom_write,
+};
@@ -0,0 +1,55 @@
+#include <stdlib.h>
+
+#include "mapper/mapper.h"
+
+/**
+ * CNROM: fixed PRG ROM as on NROM and a switchable 8 KB CHR bank.
+ * Any write to $8000-$FFFF selects the bank.
+ *
+ * Reference: http://wiki.nesdev.com/w/index.php/CNROM
+ */
+
+struct Mapper {
+  Cartridge * cartridge;
+  MapperBanks * banks;
+};
+
+static Mapper * cnrom_create(Cartridge * cartridge, MapperBanks * banks) {
+  Mapper * mapper = malloc(sizeof(Mapper));
+  if (!mapper) {
+    return NULL;
+  }
+  mapper->cartridge = cartridge;
+  mapper->banks = banks;
+
+  int prg_size = cartridge->prg_rom_size << 14;
+  for (int i = 0; i < MAPPER_PRG_WINDOWS; ++i) {
+    banks->prg[i] = cartridge->prg_rom + (i * MAPPER_PRG_WINDOW_SIZE) % prg_size;
+  }
+  mapper_banks_chr(banks, 0, MAPPER_CHR_WINDOWS, cartridge->chr_rom);
+
+  return mapper;
+}
+
+static void cnrom_destroy(Mapper * mapper) {
+  free(mapper);
+}
+
+static void cnrom_write(Mapper * mapper, uint16_t addr, uint8_t val) {
+  if (addr < 0x8000) {
+    return;
+  }
+
+  Cartridge * cartridge = mapper->cartridge;
+  int banks = cartridge->chr_rom_size;
+  int bank = val % banks;
+  mapper_banks_chr(mapper->banks, 0, MAPPER_CHR_WINDOWS, cartridge->chr_rom + (bank << 13));
+  mapper->banks->changed(mapper->banks);
+}
+
+MAPPER_INTERFACE(3) = {
+  .abi = MAPPER_ABI,
+  .create = cnrom_create,
+  .destroy = cnrom_destroy,
+  .write = cnrom_write,
+};
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+
+#include "mapper/mapper.h"
+
+/**
+ * MMC3 (TxROM): eight bank registers written through $8000/$8001, with two
+ * switchable 8 KB PRG banks, 2 KB and 1 KB CHR banks, and a scanline
+ * counter that raises an IRQ when it reaches zero.
+ *
+ * Reference: http://wiki.nesdev.com/w/index.php/MMC3
+ */
+
+struct Mapper {
+  Cartridge * cartridge;
+  MapperBanks * banks;
+
+  uint8_t select;
+  uint8_t registers[8];
+
+  uint8_t irq_latch;
+  uint8_t irq_counter;
+  bool irq_reload;
+  bool irq_enable;
+};
+
+static uint8_t * mmc3_chr_bank(Mapper * mapper, int bank) {
+  Cartridge * cartridge = mapper->cartridge;
+  int banks = cartridge->chr_rom_size * 8;
+  return cartridge->chr_rom + ((bank % banks) << 10);
+}
+
+static uint8_t * mmc3_prg_bank(Mapper * mapper, int bank) {
+  Cartridge * cartridge = mapper->cartridge;
+  int banks = cartridge->prg_rom_size * 2;
+  return cartridge->prg_rom + ((bank % banks) << 13);
+}
+
+static void mmc3_update(Mapper * mapper) {
+  MapperBanks * banks = mapper->banks;
+  uint8_t * registers = mapper->registers;
+  int last = mapper->cartridge->prg_rom_size * 2 - 1;
+
+  // Bit 6 swaps the switchable bank at $8000 with the fixed one at $C000
+  int swap = (mapper->select & 0x40) ? 2 : 0;
+  banks->prg[0 ^ swap] = mmc3_prg_bank(mapper, registers[6]);
+  banks->prg[1] = mmc3_prg_bank(mapper, registers[7]);
+  banks->prg[2 ^ swap] = mmc3_prg_bank(mapper, last - 1);
+  banks->prg[3] = mmc3_prg_bank(mapper, last);
+
+  // Bit 7 swaps the 2 KB banks at $0000 with the 1 KB banks at $1000
+  int invert = (mapper->select & 0x80) ? 4 : 0;
+  banks->chr[0 ^ invert] = mmc3_chr_bank(mapper, registers[0] & ~1);
+  banks->chr[1 ^ invert] = mmc3_chr_bank(mapper, registers[0] | 1);
+  banks->chr[2 ^ invert] = mmc3_chr_bank(mapper, registers[1] & ~1);
+  banks->chr[3 ^ invert] = mmc3_chr_bank(mapper, registers[1] | 1);
+  banks->chr[4 ^ invert] = mmc3_chr_bank(mapper, registers[2]);
+  banks->chr[5 ^ invert] = mmc3_chr_bank(mapper, registers[3]);
+  banks->chr[6 ^ invert] = mmc3_chr_bank(mapper, registers[4]);
+  banks->chr[7 ^ invert] = mmc3_chr_bank(mapper, registers[5]);
+
+  banks->changed(banks);
+}
+
+static Mapper * mmc3_create(Cartridge * cartridge, MapperBanks * banks) {
+  Mapper * mapper = calloc(1, sizeof(Mapper));
+  if (!mapper) {
+    return NULL;
+  }
+  mapper->cartridge = cartridge;
+  mapper->banks = banks;
+
+  mmc3_update(mapper);
+  return mapper;
+}
+
+static void mmc3_destroy(Mapper * mapper) {
+  free(mapper);
+}
+
+static void mmc3_write(Mapper * mapper, uint16_t addr, uint8_t val) {
+  if (addr < 0x8000) {
+    return;
+  }
+
+  MapperBanks * banks = mapper->banks;
+  bool odd = addr & 1;
+
+  switch (addr & 0xE000) {
+  case 0x8000:
+    if (odd) {
+      mapper->registers[mapper->select & 0x07] = val;
+    } else {
+      mapper->select = val;
+    }
+    mmc3_update(mapper);
+    break;
+
+  case 0xA000:
+    if (odd) {
+      // PRG RAM enable and write protection
+      banks->prg_ram = (val & 0x80) ? mapper->cartridge->save_ram : NULL;
+      banks->prg_ram_readonly = (val & 0x40) != 0;
+    } else if (mapper->cartridge->mirror != MIRROR_QUAD) {
+      banks->mirror = (val & 1) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL;
+    }
+    banks->changed(banks);
+    break;
+
+  case 0xC000:
+    if (odd) {
+      mapper->irq_counter = 0;
+      mapper->irq_reload = true;
+    } else {
+      mapper->irq_latch = val;
+    }
+    break;
+
+  case 0xE000:
+    // Disabling also acknowledges a pending IRQ
+    mapper->irq_enable = odd;
+    if (!odd && banks->irq) {
+      banks->irq = false;
+      banks->changed(banks);
+    }
+    break;
+  }
+}
+
+static void mmc3_scanline(Mapper * mapper) {
+  if (mapper->irq_counter == 0 || mapper->irq_reload) {
+    mapper->irq_counter = mapper->irq_latch;
+    mapper->irq_reload = false;
+  } else {
+    mapper->irq_counter--;
+  }
+
+  if (mapper->irq_counter == 0 && mapper->irq_enable && !mapper->banks->irq) {
+    mapper->banks->irq = true;
+    mapper->banks->changed(mapper->banks);
+  }
+}
+
+MAPPER_INTERFACE(4) = {
+  .abi = MAPPER_ABI,
+  .create = mmc3_create,
+  .destroy = mmc3_destroy,
+  .write = mmc3_write,
+  .scanline = mmc3_scanline,
+};
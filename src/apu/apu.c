@@ -1,8 +1,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include "apu.h"
+#include "clock.h"
 
 void apu_init(APU * apu) {
   apu_reset(apu);
@@ -14,6 +16,7 @@ void apu_init(APU * apu) {
 
 void apu_reset(APU * apu) {
   memset(apu, 0, sizeof(APU));
+  blip_init(&apu->blip, CPU_FREQUENCY, APU_SAMPLE_RATE);
 }
 
 float apu_sample(APU * apu) {
@@ -28,17 +31,6 @@ float apu_sample(APU * apu) {
   return pulse_out + tnd_out;
 }
 
-static void apu_period_tick(APU * apu) {
-  pulse_period_tick(&apu->pulse1);
-  pulse_period_tick(&apu->pulse2);
-
-  // Tick twice since triangle timer ticks at 2 * APU (CPU)
-  triangle_period_tick(&apu->triangle);
-  triangle_period_tick(&apu->triangle);
-
-  noise_period_tick(&apu->noise);
-}
-
 static void apu_half_frame_tick(APU * apu) {
   pulse_sweep_tick(&apu->pulse1);
   pulse_sweep_tick(&apu->pulse2);
@@ -55,52 +47,148 @@ static void apu_quarter_frame_tick(APU * apu) {
   noise_envelope_tick(&apu->noise);
 }
 
+static const uint16_t apu_steps[2][4] = {
+  {3728, 7456, 11185, 14914},
+  {3728, 7456, 11185, 18640}
+};
+
+// Next frame counter step, the step for a counter value is run on the
+// tick that sees that value
+static uint16_t apu_step(APU * apu) {
+  const uint16_t * steps = apu_steps[apu->frame_counter.mode];
+
+  int i = 0;
+  while (i < 3 && steps[i] < apu->frame_counter.clock) {
+    i++;
+  }
+
+  return steps[i];
+}
+
 /*
- * Waveform subunits are ticked at half APU intervals.
- * I assume this is to ensure ordering between period ticks
- * and frame counter ticks.
- *
  * Since I rounded down the clock values for the steps, the
  * frame counter must be ticked after the period.
  */
-static void apu_frame_counter_tick(APU * apu) {
-  if (apu->frame_counter.mode == 0) {
-    switch (apu->frame_counter.clock) {
-    case 14914:
-      // TODO: Set IRQ
-    case 7456:
-      apu_half_frame_tick(apu);
-    case 11185:
-    case 3728:
-      apu_quarter_frame_tick(apu);
-    default:
-      if (apu->frame_counter.clock == 14914) {
-        apu->frame_counter.clock = 0;
-      } else {
-        apu->frame_counter.clock++;
-      }
-    }
-  } else {
-    switch (apu->frame_counter.clock) {
-    case 18640:
-    case 7456:
-      apu_half_frame_tick(apu);
-    case 11185:
-    case 3728:
-      apu_quarter_frame_tick(apu);
-    default:
-      if (apu->frame_counter.clock == 18640) {
-        apu->frame_counter.clock = 0;
-      } else {
-        apu->frame_counter.clock++;
-      }
+static void apu_run_step(APU * apu, uint16_t step) {
+  bool last = step == apu_steps[apu->frame_counter.mode][3];
+
+  if (last && apu->frame_counter.mode == 0 && !apu->frame_counter.irq_inhibit) {
+    apu->status.frame_interrupt = true;
+  }
+
+  if (step == 7456 || last) {
+    apu_half_frame_tick(apu);
+  }
+  apu_quarter_frame_tick(apu);
+
+  apu->frame_counter.clock = last ? 0 : step + 1;
+}
+
+static void apu_period_advance(APU * apu, unsigned ticks) {
+  pulse_period_advance(&apu->pulse1, ticks);
+  pulse_period_advance(&apu->pulse2, ticks);
+
+  // The triangle timer ticks at 2 * APU (CPU)
+  triangle_period_advance(&apu->triangle, 2 * ticks);
+
+  noise_period_advance(&apu->noise, ticks);
+}
+
+// APU ticks until the output can next change, channels that are silent
+// or held at a constant level don't count
+static unsigned apu_next_edge(APU * apu) {
+  unsigned edge = UINT_MAX;
+  unsigned next;
+
+  if (apu->status.pulse1 && pulse_audible(&apu->pulse1)) {
+    next = pulse_next_edge(&apu->pulse1);
+    edge = next < edge ? next : edge;
+  }
+
+  if (apu->status.pulse2 && pulse_audible(&apu->pulse2)) {
+    next = pulse_next_edge(&apu->pulse2);
+    edge = next < edge ? next : edge;
+  }
+
+  if (apu->status.triangle && triangle_audible(&apu->triangle)) {
+    next = (triangle_next_edge(&apu->triangle) + 1) / 2;
+    edge = next < edge ? next : edge;
+  }
+
+  if (apu->status.noise && noise_audible(&apu->noise)) {
+    next = noise_next_edge(&apu->noise);
+    edge = next < edge ? next : edge;
+  }
+
+  return edge;
+}
+
+static void apu_update_level(APU * apu) {
+  float level = apu_sample(apu);
+  if (level != apu->level) {
+    blip_add_delta(&apu->blip, apu->clock - apu->frame_clock, level - apu->level);
+    apu->level = level;
+  }
+}
+
+/**
+ * Catch the APU up to a CPU cycle. The APU is clocked every other
+ * CPU cycle, so an odd cycle is left over for the next call.
+ *
+ * Rather than ticking, the timers jump straight from one change in the
+ * output to the next, stopping at frame counter steps along the way.
+ * Nothing happens in between that could be heard, so the cost is in
+ * waveform edges and register writes, not in elapsed cycles.
+ */
+void apu_run_until(APU * apu, int clock) {
+  // Registers may have been written since the last call, which shows
+  // on the first tick
+  unsigned ticks = 1;
+
+  while (clock - apu->clock >= 2) {
+    unsigned left = (clock - apu->clock) / 2;
+    uint16_t step = apu_step(apu);
+    unsigned to_step = step - apu->frame_counter.clock + 1;
+
+    ticks = ticks < left ? ticks : left;
+    ticks = ticks < to_step ? ticks : to_step;
+
+    apu_period_advance(apu, ticks);
+    apu->clock += 2 * ticks;
+
+    if (ticks == to_step) {
+      apu_run_step(apu, step);
+    } else {
+      apu->frame_counter.clock += ticks;
     }
+
+    apu_update_level(apu);
+    ticks = apu_next_edge(apu);
   }
 }
 
-void apu_tick(APU * apu) {
-  apu_period_tick(apu);
-  apu_frame_counter_tick(apu);
+/**
+ * Make the output up to where the APU has been run available to
+ * apu_read_samples, returns the number of samples waiting
+ */
+int apu_end_frame(APU * apu) {
+  blip_end_frame(&apu->blip, apu->clock - apu->frame_clock);
+  apu->frame_clock = apu->clock;
+  return blip_samples_avail(&apu->blip);
+}
+
+// Output rate for the samples of the next frame, call between frames
+void apu_set_sample_rate(APU * apu, double rate) {
+  blip_set_rates(&apu->blip, CPU_FREQUENCY, rate);
+}
+
+int apu_read_samples(APU * apu, float * out, int count) {
+  return blip_read_samples(&apu->blip, out, count);
+}
+
+// CPU cycle at which the next frame counter step is run
+int apu_next_step(APU * apu) {
+  return apu->clock + 2 * (apu_step(apu) - apu->frame_counter.clock + 1);
 }
 
 void apu_write(APU * apu, APUAddress addr, uint8_t val) {
@@ -125,13 +213,30 @@ void apu_write(APU * apu, APUAddress addr, uint8_t val) {
     apu->status.triangle = (val >> 2) & 1;
     apu->status.pulse1 = (val >> 1) & 1;
     apu->status.pulse2 = (val >> 0) & 1;
+    apu->status.dmc_interrupt = false;
 
   } else if (addr == APU_FRAME_COUNTER) {
     apu->frame_counter.mode = (val >> 7) & 1;
     apu->frame_counter.irq_inhibit = (val >> 6) & 1;
+    if (apu->frame_counter.irq_inhibit) {
+      apu->status.frame_interrupt = false;
+    }
+
+    // Writing the register restarts the sequence, which also keeps the
+    // counter within the steps of the new mode
+    apu->frame_counter.clock = 0;
   }
 }
 
+// Interrupt sources of the APU, see CPUIRQ
+bool apu_frame_irq(APU * apu) {
+  return apu->status.frame_interrupt;
+}
+
+bool apu_dmc_irq(APU * apu) {
+  return apu->status.dmc_interrupt;
+}
+
 uint8_t apu_read(APU * apu, APUAddress addr) {
   uint8_t val = 0;
 
@@ -151,12 +256,17 @@ uint8_t apu_read(APU * apu, APUAddress addr) {
     val = dmc_read(&apu->dmc, addr - APU_DMC);
 
   } else if (addr == APU_STATUS) {
+    val |= (apu->status.dmc_interrupt & 1) << 7;
+    val |= (apu->status.frame_interrupt & 1) << 6;
     val |= (apu->status.dmc & 1) << 4;
     val |= (apu->status.noise & 1) << 3;
     val |= (apu->status.triangle & 1) << 2;
     val |= (apu->status.pulse1 & 1) << 1;
     val |= (apu->status.pulse2 & 1) << 0;
 
+    // Reading acknowledges the frame interrupt
+    apu->status.frame_interrupt = false;
+
   } else if (addr == APU_FRAME_COUNTER) {
     val |= (apu->frame_counter.mode & 1) << 7;
     val |= (apu->frame_counter.irq_inhibit & 1) << 6;
@@ -210,7 +320,7 @@ int apu_test_io(APU * apu) {
         compare = 0;
       }
 
-      // TODO: interrupts not implemented
+      // Interrupt flags are read-only
       if (addr == APU_STATUS) {
         compare &= 0b00011111;
       }
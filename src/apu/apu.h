@@ -8,6 +8,9 @@
 #include "triangle.h"
 #include "noise.h"
 #include "dmc.h"
+#include "blip.h"
+
+#define APU_SAMPLE_RATE 44100
 
 /**
  * References:
@@ -42,6 +45,13 @@ struct APU {
     bool interrupt   : 1;
     uint16_t clock   : 15; // Must hold up to 18640
   } frame_counter;
+
+  int clock; // CPU cycle the APU has been run up to
+
+  // Output level changes since frame_clock, as band-limited steps
+  Blip blip;
+  float level;
+  int frame_clock;
 };
 
 typedef enum {
@@ -71,10 +81,16 @@ typedef enum {
 void apu_init(APU * apu);
 void apu_reset(APU * apu);
 
-void apu_tick(APU * apu);
+void apu_run_until(APU * apu, int clock);
+int apu_next_step(APU * apu);
 float apu_sample(APU * apu);
+int apu_end_frame(APU * apu);
+void apu_set_sample_rate(APU * apu, double rate);
+int apu_read_samples(APU * apu, float * out, int count);
 void apu_write(APU * apu, APUAddress addr, uint8_t val);
 uint8_t apu_read(APU * apu, APUAddress addr);
+bool apu_frame_irq(APU * apu);
+bool apu_dmc_irq(APU * apu);
 
 int apu_test_io(APU * apu);
 
@@ -0,0 +1,129 @@
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+#include "blip.h"
+
+#define BLIP_FRAC_BITS 32
+#define BLIP_PHASE_BITS 5 // log2(BLIP_PHASES)
+
+// Fraction of the Nyquist frequency that is let through
+#define BLIP_CUTOFF 0.9
+
+// How fast the DC offset is tracked, about 20 Hz at 44.1 kHz
+#define BLIP_HIGHPASS 0.003f
+
+/**
+ * One windowed sinc impulse per fraction of a sample a step can start at,
+ * each summing to 1 so a step of delta ends up delta higher. Built once,
+ * by whichever APU is created first on any thread.
+ */
+static float blip_kernel[BLIP_PHASES][BLIP_TAPS];
+static gsize blip_kernel_ready = 0;
+
+static void blip_init_kernel(void) {
+  for (int phase = 0; phase < BLIP_PHASES; ++phase) {
+    double sum = 0;
+    double taps[BLIP_TAPS];
+
+    for (int i = 0; i < BLIP_TAPS; ++i) {
+      // Distance from the step, which is delayed by half the kernel
+      double t = i - (BLIP_TAPS / 2 - 1) - (double)phase / BLIP_PHASES;
+      double x = M_PI * BLIP_CUTOFF * t;
+      double sinc = t == 0 ? 1 : sin(x) / x;
+
+      double w = 2 * M_PI * t / BLIP_TAPS;
+      double blackman = 0.42 + 0.5 * cos(w) + 0.08 * cos(2 * w);
+
+      taps[i] = sinc * blackman;
+      sum += taps[i];
+    }
+
+    for (int i = 0; i < BLIP_TAPS; ++i) {
+      blip_kernel[phase][i] = taps[i] / sum;
+    }
+  }
+}
+
+void blip_init(Blip * blip, double clock_rate, double sample_rate) {
+  if (g_once_init_enter(&blip_kernel_ready)) {
+    blip_init_kernel();
+    g_once_init_leave(&blip_kernel_ready, 1);
+  }
+  blip_set_rates(blip, clock_rate, sample_rate);
+  blip_clear(blip);
+}
+
+// May be called between frames to nudge the output rate
+void blip_set_rates(Blip * blip, double clock_rate, double sample_rate) {
+  blip->factor = (uint64_t)(sample_rate / clock_rate * ((uint64_t)1 << BLIP_FRAC_BITS));
+}
+
+void blip_clear(Blip * blip) {
+  blip->offset = 0;
+  blip->avail = 0;
+  blip->integrator = 0;
+  blip->dc = 0;
+  memset(blip->buffer, 0, sizeof(blip->buffer));
+}
+
+/**
+ * Add a change in level at a clock counted from the start of the frame.
+ * Changes past the end of the buffer are dropped, so samples must be read
+ * at least every BLIP_BUFFER_SIZE samples.
+ */
+void blip_add_delta(Blip * blip, int time, float delta) {
+  uint64_t pos = blip->offset + (uint64_t)time * blip->factor;
+  uint64_t index = pos >> BLIP_FRAC_BITS;
+  int phase = (pos >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+  if (index >= BLIP_BUFFER_SIZE) {
+    return;
+  }
+
+  float * out = &blip->buffer[index];
+  const float * kernel = blip_kernel[phase];
+  for (int i = 0; i < BLIP_TAPS; ++i) {
+    out[i] += kernel[i] * delta;
+  }
+}
+
+// Finish a frame of the given length, making its samples readable
+void blip_end_frame(Blip * blip, int clocks) {
+  blip->offset += (uint64_t)clocks * blip->factor;
+  blip->avail = blip->offset >> BLIP_FRAC_BITS;
+
+  if (blip->avail > BLIP_BUFFER_SIZE) {
+    blip->avail = BLIP_BUFFER_SIZE;
+    blip->offset = (uint64_t)BLIP_BUFFER_SIZE << BLIP_FRAC_BITS;
+  }
+}
+
+int blip_samples_avail(Blip * blip) {
+  return blip->avail;
+}
+
+int blip_read_samples(Blip * blip, float * out, int count) {
+  if (count > blip->avail) {
+    count = blip->avail;
+  }
+
+  float integrator = blip->integrator;
+  float dc = blip->dc;
+  for (int i = 0; i < count; ++i) {
+    integrator += blip->buffer[i];
+    out[i] = integrator - dc;
+    dc += (integrator - dc) * BLIP_HIGHPASS;
+  }
+  blip->integrator = integrator;
+  blip->dc = dc;
+
+  // Shift what's left, including the tails of the last steps, to the front
+  int remaining = blip->avail - count + BLIP_TAPS;
+  memmove(blip->buffer, blip->buffer + count, remaining * sizeof(float));
+  memset(blip->buffer + remaining, 0, count * sizeof(float));
+
+  blip->avail -= count;
+  blip->offset -= (uint64_t)count << BLIP_FRAC_BITS;
+  return count;
+}
@@ -0,0 +1,45 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <stdint.h>
+
+/**
+ * Band-limited step synthesis
+ *
+ * Instead of sampling the APU output, the APU reports every change in its
+ * output level along with the clock it happened on. Each change is added
+ * to the buffer as a band-limited step, so the output has no aliasing from
+ * the edges and costs nothing between them.
+ *
+ * The buffer holds the differences between samples, reading integrates
+ * them and takes out the DC offset.
+ *
+ * References:
+ * http://www.slack.net/~ant/bl-synth/
+ */
+
+#define BLIP_PHASES 32
+#define BLIP_TAPS 16
+#define BLIP_BUFFER_SIZE 4096 // Samples that can be waiting to be read
+
+typedef struct Blip Blip;
+struct Blip {
+  uint64_t factor; // Samples per clock, 32.32 fixed point
+  uint64_t offset; // Start of the current frame in samples, 32.32
+  int avail;       // Whole samples ready to be read
+
+  float integrator;
+  float dc;
+  float buffer[BLIP_BUFFER_SIZE + BLIP_TAPS];
+};
+
+void blip_init(Blip * blip, double clock_rate, double sample_rate);
+void blip_set_rates(Blip * blip, double clock_rate, double sample_rate);
+void blip_clear(Blip * blip);
+
+void blip_add_delta(Blip * blip, int time, float delta);
+void blip_end_frame(Blip * blip, int clocks);
+int blip_samples_avail(Blip * blip);
+int blip_read_samples(Blip * blip, float * out, int count);
+
+#endif
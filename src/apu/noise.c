@@ -1,5 +1,6 @@
 #include "noise.h"
 #include "length-table.h"
+#include "timer.h"
 
 static uint16_t noise_timer_periods[16] = {
   4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
@@ -35,15 +36,37 @@ static void noise_shift(Noise * noise) {
   noise->shift_register |= feedback << 14;
 }
 
-void noise_period_tick(Noise * noise) {
-  if (noise->period_timer == 0) {
-    noise_shift(noise);
-    noise->period_timer = noise_timer_periods[noise->period];
+bool noise_audible(Noise * noise) {
+  if (!noise->loop && noise->length_timer == 0) {
+    return false;
+  }
+
+  if (noise->envelope_disabled) {
+    return noise->volume != 0;
   } else {
-    noise->period_timer--;
+    return noise->envelope_val != 0;
+  }
+}
+
+/**
+ * The shift register has no shortcut, but it's only a few instructions
+ * per shift, and shifts are far apart compared to APU ticks
+ */
+void noise_period_advance(Noise * noise, unsigned ticks) {
+  unsigned timer = noise->period_timer;
+  unsigned clocks = timer_advance(&timer, noise_timer_periods[noise->period], ticks);
+  noise->period_timer = timer;
+
+  while (clocks--) {
+    noise_shift(noise);
   }
 }
 
+// Any shift can change the output
+unsigned noise_next_edge(Noise * noise) {
+  return timer_until(noise->period_timer, noise_timer_periods[noise->period], 0);
+}
+
 void noise_length_tick(Noise * noise) {
   if (!noise->loop && noise->length_timer != 0) {
     noise->length_timer--;
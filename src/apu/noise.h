@@ -30,7 +30,9 @@ struct Noise {
 
 void noise_init(Noise * noise);
 uint8_t noise_sample(Noise * noise);
-void noise_period_tick(Noise * noise);
+bool noise_audible(Noise * noise);
+void noise_period_advance(Noise * noise, unsigned ticks);
+unsigned noise_next_edge(Noise * noise);
 void noise_length_tick(Noise * noise);
 void noise_envelope_tick(Noise * noise);
 
@@ -1,5 +1,8 @@
+#include <limits.h>
+
 #include "pulse.h"
 #include "length-table.h"
+#include "timer.h"
 
 static uint8_t pulse_sequencer[4][8] = {
   {0, 0, 0, 0, 0, 0, 0, 1},
@@ -28,15 +31,39 @@ uint8_t pulse_sample(Pulse * pulse) {
   }
 }
 
-void pulse_period_tick(Pulse * pulse) {
-  if (pulse->period_timer != 0) {
-    pulse->period_timer--;
+// Whether the sequencer shows in the output at all
+bool pulse_audible(Pulse * pulse) {
+  if (!pulse->loop && pulse->length_timer == 0) {
+    return false;
+  }
+
+  if (pulse->envelope_disabled) {
+    return pulse->volume != 0;
   } else {
-    pulse->phase++;
-    pulse->period_timer = pulse->period;
+    return pulse->envelope_val != 0;
   }
 }
 
+void pulse_period_advance(Pulse * pulse, unsigned ticks) {
+  unsigned timer = pulse->period_timer;
+  unsigned clocks = timer_advance(&timer, pulse->period, ticks);
+  pulse->period_timer = timer;
+  pulse->phase = (pulse->phase + clocks) & 7;
+}
+
+// Ticks until the duty cycle next flips, skipping steps that don't
+unsigned pulse_next_edge(Pulse * pulse) {
+  const uint8_t * sequence = pulse_sequencer[pulse->duty];
+
+  for (unsigned n = 1; n < 8; ++n) {
+    if (sequence[(pulse->phase + n) & 7] != sequence[pulse->phase]) {
+      return timer_until(pulse->period_timer, pulse->period, n - 1);
+    }
+  }
+
+  return UINT_MAX;
+}
+
 void pulse_length_tick(Pulse * pulse) {
   if (!pulse->loop && pulse->length_timer != 0) {
     pulse->length_timer--;
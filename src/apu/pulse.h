@@ -41,7 +41,9 @@ struct Pulse {
 
 void pulse_init(Pulse * pulse, uint8_t channel);
 uint8_t pulse_sample(Pulse * pulse);
-void pulse_period_tick(Pulse * pulse);
+bool pulse_audible(Pulse * pulse);
+void pulse_period_advance(Pulse * pulse, unsigned ticks);
+unsigned pulse_next_edge(Pulse * pulse);
 void pulse_length_tick(Pulse * pulse);
 void pulse_sweep_tick(Pulse * pulse);
 void pulse_envelope_tick(Pulse * pulse);
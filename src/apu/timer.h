@@ -0,0 +1,28 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/**
+ * Closed form of the dividers driving the waveform sequencers: the timer
+ * counts down once per tick, and on the tick after reaching 0 it clocks
+ * the sequencer and reloads with period.
+ *
+ * Advance by any number of ticks at once, returns how many times the
+ * sequencer was clocked.
+ */
+static inline unsigned timer_advance(unsigned * timer, unsigned period, unsigned ticks) {
+  if (ticks <= *timer) {
+    *timer -= ticks;
+    return 0;
+  }
+
+  ticks -= *timer + 1;
+  *timer = period - ticks % (period + 1);
+  return 1 + ticks / (period + 1);
+}
+
+// Ticks until the sequencer is clocked after n more reloads
+static inline unsigned timer_until(unsigned timer, unsigned period, unsigned n) {
+  return timer + 1 + n * (period + 1);
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "triangle.h"
 #include "length-table.h"
+#include "timer.h"
 
 static uint8_t triangle_sequencer[32] = {
   15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
@@ -20,13 +21,21 @@ uint8_t triangle_sample(Triangle * triangle) {
   return triangle_sequencer[triangle->phase];
 }
 
-void triangle_period_tick(Triangle * triangle) {
-  if (triangle->period_timer == 0) {
-    triangle->phase++;
-    triangle->period_timer = triangle->period;
-  } else {
-    triangle->period_timer--;
-  }
+bool triangle_audible(Triangle * triangle) {
+  return !(triangle->control_flag && triangle->length_timer == 0);
+}
+
+// The timer ticks at the CPU rate, twice per APU tick
+void triangle_period_advance(Triangle * triangle, unsigned ticks) {
+  unsigned timer = triangle->period_timer;
+  unsigned clocks = timer_advance(&timer, triangle->period, ticks);
+  triangle->period_timer = timer;
+  triangle->phase = (triangle->phase + clocks) & 31;
+}
+
+// Timer ticks until the next step, every step but the ends of the ramp moves
+unsigned triangle_next_edge(Triangle * triangle) {
+  return timer_until(triangle->period_timer, triangle->period, 0);
 }
 
 void triangle_length_tick(Triangle * triangle) {
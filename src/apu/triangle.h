@@ -26,7 +26,9 @@ struct Triangle {
 
 void triangle_init(Triangle * pulse);
 uint8_t triangle_sample(Triangle * triangle);
-void triangle_period_tick(Triangle * triangle);
+bool triangle_audible(Triangle * triangle);
+void triangle_period_advance(Triangle * triangle, unsigned ticks);
+unsigned triangle_next_edge(Triangle * triangle);
 void triangle_length_tick(Triangle * triangle);
 void triangle_linear_tick(Triangle * triangle);
 
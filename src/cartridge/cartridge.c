@@ -5,101 +5,224 @@
 
 #include "cartridge.h"
 #include "cartridge.r"
+#include "header.h"
+#include "save.h"
 #include "mapper/mapper.h"
 
-typedef struct NESHeader {
-  uint8_t magic[4];
-  uint8_t prg_rom_size;
-  uint8_t chr_rom_size;
+#define CARTRIDGE_ROUND_UP(size, unit) (((size) + (unit) - 1) / (unit) * (unit))
 
-  // Flags 6
-  uint8_t mirror_vert  : 1;
-  uint8_t prg_ram      : 1;
-  uint8_t trainer      : 1;
-  uint8_t mirror_quad  : 1;
-  uint8_t mapper_low   : 4;
+/**
+ * Point PRG and CHR ROM straight into a read-only mapping of the file, so
+ * every emulator running the same ROM shares its pages. Fails when the
+ * file isn't local, is shorter than its header says, or has ROM sizes
+ * that aren't whole banks.
+ */
+static bool cartridge_map_rom(Cartridge * cartridge, GFile * rom_file, NESLayout * layout) {
+  char * path = g_file_get_path(rom_file);
+  if (!path) {
+    return false;
+  }
 
-  // Flags 7
-  uint8_t vs_unisystem : 1;
-  uint8_t playchoice10 : 1;
-  uint8_t version      : 2;
-  uint8_t mapper_high  : 4;
+  GMappedFile * mapping = g_mapped_file_new(path, FALSE, NULL);
+  g_free(path);
+  if (!mapping) {
+    return false;
+  }
 
-  uint8_t prg_ram_size;
-  uint8_t zero[7];
-} NESHeader;
+  uint8_t * contents = (uint8_t *)g_mapped_file_get_contents(mapping);
+  gsize length = g_mapped_file_get_length(mapping);
+  if (length < sizeof(NESHeader) || !header_layout((NESHeader *)contents, layout) ||
+      layout->prg_rom_size % 0x4000 != 0 || layout->chr_rom_size % 0x2000 != 0) {
+    g_mapped_file_unref(mapping);
+    return false;
+  }
 
-static uint8_t nes_magic[] = {'N', 'E', 'S', 0x1A};
+  // Skip the trainer (don't worry about this yet)
+  gsize prg_offset = sizeof(NESHeader) + (layout->trainer ? 512 : 0);
+  gsize chr_offset = prg_offset + layout->prg_rom_size;
+  if (length < chr_offset + layout->chr_rom_size) {
+    g_mapped_file_unref(mapping);
+    return false;
+  }
 
-Cartridge * cartridge_create(GFile * rom_file) {
+  cartridge->rom_mapping = mapping;
+  cartridge->prg_rom = layout->prg_rom_size ? contents + prg_offset : NULL;
+  cartridge->chr_rom = layout->chr_rom_size ? contents + chr_offset : NULL;
+  return true;
+}
+
+// Copy PRG and CHR ROM out of the file, zero filling a short read and
+// rounding the ROM up to whole banks
+static bool cartridge_read_rom(Cartridge * cartridge, GFile * rom_file, NESLayout * layout) {
   GInputStream * stream = (GInputStream *)g_file_read(rom_file, NULL, NULL);
   if (stream == NULL) {
-    return NULL;
+    return false;
   }
 
   // Read header
   NESHeader header;
-  g_input_stream_read(stream, &header, sizeof(header), NULL, NULL);
-
-  if (memcmp(&header.magic, nes_magic, 4) != 0) {
+  if (g_input_stream_read(stream, &header, sizeof(NESHeader), NULL, NULL) != sizeof(NESHeader) ||
+      !header_layout(&header, layout)) {
     fprintf(stderr, "ERROR: File is not a ROM file!\n");
-    return NULL;
+    g_input_stream_close(stream, NULL, NULL);
+    g_object_unref(stream);
+    return false;
   }
 
   // Read trainer (don't worry about this yet)
-  if (header.trainer) {
+  if (layout->trainer) {
     g_input_stream_skip(stream, 512, NULL, NULL);
   }
 
   // Read PRG ROM data
-  uint8_t * prg_rom;
-  uint8_t prg_rom_size = header.prg_rom_size;
-  if (prg_rom_size != 0) {
-    prg_rom = g_malloc0(prg_rom_size << 14);
-    g_input_stream_read(stream, prg_rom, prg_rom_size << 14, NULL, NULL);
+  if (layout->prg_rom_size != 0) {
+    cartridge->prg_rom = g_malloc0(CARTRIDGE_ROUND_UP(layout->prg_rom_size, 0x4000));
+    g_input_stream_read(stream, cartridge->prg_rom, layout->prg_rom_size, NULL, NULL);
   } else {
-    prg_rom = NULL;
+    cartridge->prg_rom = NULL;
   }
 
   // Read CHR ROM data
-  void * chr_rom;
-  uint8_t chr_rom_size = header.chr_rom_size;
-  if (chr_rom_size != 0) {
-    chr_rom = g_malloc0(chr_rom_size << 13);
-    g_input_stream_read(stream, chr_rom, chr_rom_size << 13, NULL, NULL);
+  if (layout->chr_rom_size != 0) {
+    cartridge->chr_rom = g_malloc0(CARTRIDGE_ROUND_UP(layout->chr_rom_size, 0x2000));
+    g_input_stream_read(stream, cartridge->chr_rom, layout->chr_rom_size, NULL, NULL);
   } else {
-    chr_rom = NULL;
+    cartridge->chr_rom = NULL;
   }
 
   g_input_stream_close(stream, NULL, NULL);
+  g_object_unref(stream);
+
+  cartridge->rom_mapping = NULL;
+  return true;
+}
+
+/**
+ * Back the save RAM with a .sav file next to the ROM when the cartridge
+ * has a battery, otherwise it only lasts as long as the cartridge
+ */
+static void cartridge_open_save(Cartridge * cartridge, GFile * rom_file) {
+  cartridge->save = NULL;
+  if (cartridge->save_ram_size == 0) {
+    cartridge->save_ram = NULL;
+    return;
+  }
+
+  char * path = cartridge->prg_ram ? g_file_get_path(rom_file) : NULL;
+  if (!path) {
+    cartridge->save_ram = g_malloc0(cartridge->save_ram_size);
+    return;
+  }
+
+  char * extension = strrchr(path, '.');
+  if (extension && !strchr(extension, G_DIR_SEPARATOR)) {
+    *extension = '\0';
+  }
+
+  char * save_path = g_strconcat(path, ".sav", NULL);
+  cartridge->save = save_open(save_path, cartridge->save_ram_size);
+  cartridge->save_ram = save_ram(cartridge->save);
+
+  g_free(save_path);
+  g_free(path);
+}
+
+/**
+ * CHR is decoded to a byte per pixel, 8 to each row of a tile and 64 to
+ * a tile, so the PPU doesn't have to combine the two bit planes of every
+ * pixel it draws. Rows are decoded again as CHR RAM is written.
+ */
+static size_t cartridge_chr_size(Cartridge * cartridge) {
+  return (size_t)cartridge->chr_rom_size << 13;
+}
+
+static void cartridge_decode_chr(Cartridge * cartridge, size_t row) {
+  const uint8_t * planes = cartridge->chr_rom + (row >> 3 << 4 | (row & 7));
+  uint8_t * pixels = cartridge->chr_pixels + row * 8;
+
+  for (int x = 0; x < 8; ++x) {
+    pixels[x] = (planes[0] >> (7 - x) & 1) | (planes[8] >> (7 - x) & 1) << 1;
+  }
+}
+
+// Row of the decoded CHR holding a byte of either plane
+static size_t cartridge_chr_row(size_t offset) {
+  return offset >> 4 << 3 | (offset & 7);
+}
+
+static void cartridge_close_save(Cartridge * cartridge) {
+  if (cartridge->save) {
+    save_close(cartridge->save);
+  } else {
+    g_free(cartridge->save_ram);
+  }
+}
 
-  // Mapper number
-  uint8_t mapper_no = header.mapper_high << 4 | header.mapper_low;
+static void cartridge_free_rom(Cartridge * cartridge) {
+  if (cartridge->rom_mapping) {
+    g_mapped_file_unref(cartridge->rom_mapping);
+  } else {
+    g_free(cartridge->prg_rom);
+    if (!cartridge->chr_ram) {
+      g_free(cartridge->chr_rom);
+    }
+  }
+
+  if (cartridge->chr_ram) {
+    g_free(cartridge->chr_rom);
+  }
+  g_free(cartridge->chr_pixels);
+}
+
+Cartridge * cartridge_create(GFile * rom_file) {
+  Cartridge * cartridge = g_malloc0(sizeof(Cartridge));
+
+  NESLayout layout;
+  if (!cartridge_map_rom(cartridge, rom_file, &layout) &&
+      !cartridge_read_rom(cartridge, rom_file, &layout)) {
+    g_free(cartridge);
+    return NULL;
+  }
+
+  // Make room for CHR RAM, the PPU always sees 8 KB of pattern tables
+  size_t chr_ram_size = layout.chr_ram_size + layout.chr_nvram_size;
+  if (layout.chr_rom_size == 0) {
+    chr_ram_size = CARTRIDGE_ROUND_UP(MAX(chr_ram_size, 0x2000), 0x2000);
+    cartridge->chr_rom = g_malloc0(chr_ram_size);
+  }
 
   // Mirroring
   Mirror mirror;
-  if (header.mirror_quad) {
+  if (layout.mirror_quad) {
     mirror = MIRROR_QUAD;
-  } else if (header.mirror_vert) {
+  } else if (layout.mirror_vert) {
     mirror = MIRROR_VERTICAL;
   } else {
     mirror = MIRROR_HORIZONTAL;
   }
 
-  Cartridge * cartridge = g_malloc(sizeof(Cartridge));
-  cartridge->mapper_no = mapper_no;
-  cartridge->prg_rom = prg_rom;
-  cartridge->chr_rom = chr_rom;
-  cartridge->save_ram = g_malloc0(0x2000);
-  cartridge->prg_rom_size = prg_rom_size;
-  cartridge->chr_rom_size = chr_rom_size;
+  cartridge->mapper_no = layout.mapper;
+  cartridge->submapper = layout.submapper;
+  cartridge->timing = layout.timing;
+  cartridge->prg_rom_size = CARTRIDGE_ROUND_UP(layout.prg_rom_size, 0x4000) >> 14;
+  cartridge->chr_rom_size = (layout.chr_rom_size ? CARTRIDGE_ROUND_UP(layout.chr_rom_size, 0x2000) : chr_ram_size) >> 13;
+  cartridge->save_ram_size = layout.prg_ram_size + layout.prg_nvram_size;
   cartridge->mirror = mirror;
-  cartridge->prg_ram = header.prg_ram;
+  cartridge->prg_ram = layout.prg_nvram_size != 0;
+  cartridge->chr_ram = layout.chr_rom_size == 0;
+  cartridge_open_save(cartridge, rom_file);
+
+  cartridge->chr_pixels = g_malloc(cartridge_chr_size(cartridge) * 4);
+  for (size_t row = 0; row < cartridge_chr_size(cartridge) / 2; ++row) {
+    cartridge_decode_chr(cartridge, row);
+  }
+  cartridge->prg_sha1 = g_compute_checksum_for_data(G_CHECKSUM_SHA1, cartridge->prg_rom, layout.prg_rom_size);
 
   cartridge->mapper = mapper_create(cartridge);
   if (!cartridge->mapper) {
-    g_free(cartridge->prg_rom);
-    g_free(cartridge->chr_rom);
+    cartridge_free_rom(cartridge);
+    cartridge_close_save(cartridge);
+    g_free(cartridge->prg_sha1);
     g_free(cartridge);
     return NULL;
   }
@@ -109,15 +232,109 @@ Cartridge * cartridge_create(GFile * rom_file) {
 
 void cartridge_destroy(Cartridge * cartridge) {
   mapper_destroy(cartridge->mapper);
-  g_free(cartridge->prg_rom);
-  g_free(cartridge->chr_rom);
+  cartridge_free_rom(cartridge);
+  cartridge_close_save(cartridge);
+  g_free(cartridge->prg_sha1);
   g_free(cartridge);
 }
 
+// Hand any changes to the save RAM to the save file, call between frames
+void cartridge_sync_save(Cartridge * cartridge) {
+  if (cartridge->save && cartridge->save_dirty) {
+    cartridge->save_dirty = false;
+    save_sync(cartridge->save);
+  }
+}
+
+static bool cartridge_save_addr(Cartridge * cartridge, uint16_t addr) {
+  return cartridge->save && addr >= 0x6000 && addr <= 0x7FFF;
+}
+
 void cartridge_write(Cartridge * cartridge, uint16_t addr, uint8_t val) {
+  if (cartridge_save_addr(cartridge, addr)) {
+    cartridge->save_dirty = true;
+  }
   mapper_write(cartridge->mapper, addr, val);
 }
 
 uint8_t cartridge_read(Cartridge * cartridge, uint16_t addr) {
   return mapper_read(cartridge->mapper, addr);
 }
+
+/**
+ * Host memory behind a 256 byte page, or NULL if the mapper must see
+ * accesses. Battery backed RAM is never writable through here, see
+ * cartridge_save_page.
+ */
+uint8_t * cartridge_page(Cartridge * cartridge, uint16_t addr, bool write) {
+  if (write && cartridge_save_addr(cartridge, addr)) {
+    return NULL;
+  }
+  return mapper_page(cartridge->mapper, addr, write);
+}
+
+/**
+ * Writable host memory behind a page of battery backed RAM, or NULL if it
+ * isn't one or the mapper has it disabled. Writes to it must be followed
+ * by cartridge_save_written, so the save is only compared with the file
+ * after it has been written.
+ */
+uint8_t * cartridge_save_page(Cartridge * cartridge, uint16_t addr) {
+  if (!cartridge_save_addr(cartridge, addr)) {
+    return NULL;
+  }
+  return mapper_page(cartridge->mapper, addr, true);
+}
+
+void cartridge_save_written(Cartridge * cartridge) {
+  cartridge->save_dirty = true;
+}
+
+// Whether pages without host memory may read differently after any write
+bool cartridge_hides_banks(Cartridge * cartridge) {
+  return mapper_hides_banks(cartridge->mapper);
+}
+
+void cartridge_on_change(Cartridge * cartridge, void (*callback)(void * data), void * data) {
+  mapper_on_change(cartridge->mapper, callback, data);
+}
+
+// What is switched into the PPU address space
+const MapperBanks * cartridge_banks(Cartridge * cartridge) {
+  return mapper_banks(cartridge->mapper);
+}
+
+// Whether the mapper has a scanline counter to clock
+bool cartridge_has_scanline(Cartridge * cartridge) {
+  return mapper_has_scanline(cartridge->mapper);
+}
+
+// Clock the mapper's scanline counter, if it has one
+void cartridge_scanline(Cartridge * cartridge) {
+  mapper_scanline(cartridge->mapper);
+}
+
+/**
+ * Decoded pixels at a byte of CHR, which must start a row of a tile, or
+ * NULL if it isn't the cartridge's. A bank window can be looked up once,
+ * its tiles follow each other as they do in CHR.
+ */
+const uint8_t * cartridge_chr_pixels(Cartridge * cartridge, const uint8_t * chr) {
+  if (chr < cartridge->chr_rom || chr >= cartridge->chr_rom + cartridge_chr_size(cartridge)) {
+    return NULL;
+  }
+  return cartridge->chr_pixels + cartridge_chr_row(chr - cartridge->chr_rom) * 8;
+}
+
+// Write a byte of CHR RAM, keeping its decoded row up to date
+void cartridge_chr_write(Cartridge * cartridge, uint8_t * chr, uint8_t val) {
+  *chr = val;
+  if (chr >= cartridge->chr_rom && chr < cartridge->chr_rom + cartridge_chr_size(cartridge)) {
+    cartridge_decode_chr(cartridge, cartridge_chr_row(chr - cartridge->chr_rom));
+  }
+}
+
+// Whether the mapper is holding the IRQ line, as of its last change
+bool cartridge_irq(Cartridge * cartridge) {
+  return mapper_banks(cartridge->mapper)->irq;
+}
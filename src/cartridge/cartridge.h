@@ -2,15 +2,29 @@
 #define CARTRIDGE_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <gio/gio.h>
 
 typedef struct Cartridge Cartridge;
+typedef struct MapperBanks MapperBanks;
 
 Cartridge * cartridge_create(GFile * rom_file);
 void cartridge_destroy(Cartridge * cartridge);
+void cartridge_sync_save(Cartridge * cartridge);
 
 void cartridge_write(Cartridge * cartridge, uint16_t addr, uint8_t val);
 uint8_t cartridge_read(Cartridge * cartridge, uint16_t addr);
+uint8_t * cartridge_page(Cartridge * cartridge, uint16_t addr, bool write);
+uint8_t * cartridge_save_page(Cartridge * cartridge, uint16_t addr);
+void cartridge_save_written(Cartridge * cartridge);
+bool cartridge_hides_banks(Cartridge * cartridge);
+void cartridge_on_change(Cartridge * cartridge, void (*callback)(void * data), void * data);
+bool cartridge_irq(Cartridge * cartridge);
+const MapperBanks * cartridge_banks(Cartridge * cartridge);
+bool cartridge_has_scanline(Cartridge * cartridge);
+void cartridge_scanline(Cartridge * cartridge);
+const uint8_t * cartridge_chr_pixels(Cartridge * cartridge, const uint8_t * chr);
+void cartridge_chr_write(Cartridge * cartridge, uint8_t * chr, uint8_t val);
 
 #endif
@@ -4,28 +4,41 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "header.h"
+
 typedef struct Mapper Mapper;
 typedef struct Cartridge Cartridge;
 
 typedef enum {
   MIRROR_HORIZONTAL,
   MIRROR_VERTICAL,
-  MIRROR_QUAD
+  MIRROR_QUAD,
+  MIRROR_SINGLE_LOWER,
+  MIRROR_SINGLE_UPPER
 } Mirror;
 
 struct Cartridge {
   Mapper * mapper; // Maybe this shouldn't be "public"
   int mapper_no;   // Maybe this shouldn't be "public"
-
-  uint8_t * prg_rom;
-  uint8_t * chr_rom;
-  uint8_t * save_ram; // Always 0x2000 bytes
-
-  uint8_t prg_rom_size;
-  uint8_t chr_rom_size;
-
-  Mirror mirror : 2;
-  bool prg_ram : 1;
+  int submapper;   // 0 unless the header is NES 2.0
+  Timing timing;
+
+  uint8_t * prg_rom;    // Read-only when rom_mapping is set
+  uint8_t * chr_rom;    // CHR RAM when chr_ram is set
+  uint8_t * chr_pixels; // chr_rom decoded, see cartridge_chr_pixels
+  uint8_t * save_ram;   // PRG RAM, save_ram_size bytes
+  void * save;          // Save file behind save_ram, NULL without a battery
+  char * prg_sha1;      // Identifies the game, in hex
+  void * rom_mapping;   // GMappedFile of the ROM file, NULL if it was copied
+
+  uint16_t prg_rom_size;  // In 16 KB banks
+  uint16_t chr_rom_size;  // In 8 KB banks, of CHR RAM when chr_ram is set
+  uint32_t save_ram_size; // 0 when the board has no PRG RAM
+
+  Mirror mirror : 3;
+  bool prg_ram : 1; // Battery backed
+  bool chr_ram : 1;
+  bool save_dirty : 1; // Save RAM was written since the last cartridge_sync_save
 };
 
 #endif
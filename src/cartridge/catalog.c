@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "catalog.h"
+
+#define CATALOG_MAGIC "nes-emu catalog 1"
+
+typedef struct CatalogDir {
+  char * path;
+  int64_t mtime;    // Nanoseconds
+  GPtrArray * files; // CatalogEntry, owned by the catalog
+  GPtrArray * dirs;  // Paths of subdirectories
+} CatalogDir;
+
+struct Catalog {
+  char * root;
+  char * cache_path;
+
+  GPtrArray * dirs;    // Every CatalogDir
+  GPtrArray * entries; // Every CatalogEntry, valid or not
+  GPtrArray * roms;    // Valid entries, sorted by path
+};
+
+// What the catalog held before a rescan, to reuse whatever didn't change
+typedef struct CatalogScan {
+  GHashTable * dirs;  // CatalogDir by path
+  GHashTable * files; // CatalogEntry by path
+  GThreadPool * pool;
+  bool changed;       // The cache needs to be written again
+} CatalogScan;
+
+static uint32_t crc32_table[256];
+
+static void catalog_crc32_init(void) {
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 1 ? crc >> 1 ^ 0xEDB88320 : crc >> 1;
+    }
+    crc32_table[i] = crc;
+  }
+}
+
+static uint32_t catalog_crc32(const uint8_t * data, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; ++i) {
+    crc = crc >> 8 ^ crc32_table[(crc ^ data[i]) & 0xFF];
+  }
+  return ~crc;
+}
+
+static int64_t catalog_mtime(const GStatBuf * stat) {
+  return (int64_t)stat->st_mtim.tv_sec * 1000000000 + stat->st_mtim.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static CatalogEntry * catalog_entry_new(const char * path) {
+  CatalogEntry * entry = g_malloc0(sizeof(CatalogEntry));
+  entry->path = g_strdup(path);
+  return entry;
+}
+
+static void catalog_entry_free(gpointer data) {
+  CatalogEntry * entry = data;
+  g_free(entry->path);
+  g_free(entry);
+}
+
+static CatalogDir * catalog_dir_new(const char * path, int64_t mtime) {
+  CatalogDir * dir = g_malloc0(sizeof(CatalogDir));
+  dir->path = g_strdup(path);
+  dir->mtime = mtime;
+  dir->files = g_ptr_array_new();
+  dir->dirs = g_ptr_array_new_with_free_func(g_free);
+  return dir;
+}
+
+static void catalog_dir_free(gpointer data) {
+  CatalogDir * dir = data;
+  g_ptr_array_free(dir->files, TRUE);
+  g_ptr_array_free(dir->dirs, TRUE);
+  g_free(dir->path);
+  g_free(dir);
+}
+
+// Runs on the thread pool, each entry is only touched by one worker
+static void catalog_hash(gpointer data, gpointer user_data) {
+  CatalogEntry * entry = data;
+  (void)user_data;
+
+  entry->valid = false;
+
+  GMappedFile * mapping = g_mapped_file_new(entry->path, FALSE, NULL);
+  if (!mapping) {
+    return;
+  }
+
+  const uint8_t * contents = (const uint8_t *)g_mapped_file_get_contents(mapping);
+  gsize length = g_mapped_file_get_length(mapping);
+  if (length >= sizeof(NESHeader)) {
+    memcpy(&entry->header, contents, sizeof(NESHeader));
+    entry->valid = header_valid(&entry->header);
+  }
+
+  if (entry->valid) {
+    const uint8_t * data = contents + sizeof(NESHeader);
+    gsize size = length - sizeof(NESHeader);
+
+    entry->crc32 = catalog_crc32(data, size);
+
+    char * sha1 = g_compute_checksum_for_data(G_CHECKSUM_SHA1, data, size);
+    g_strlcpy(entry->sha1, sha1, sizeof(entry->sha1));
+    g_free(sha1);
+  }
+
+  g_mapped_file_unref(mapping);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void catalog_scan_file(Catalog * catalog, CatalogScan * scan, CatalogDir * dir, const char * path, const GStatBuf * stat) {
+  CatalogEntry * entry = catalog_entry_new(path);
+  entry->size = stat->st_size;
+  entry->mtime = catalog_mtime(stat);
+
+  CatalogEntry * old = g_hash_table_lookup(scan->files, path);
+  if (old && old->size == entry->size && old->mtime == entry->mtime) {
+    entry->valid = old->valid;
+    entry->header = old->header;
+    entry->crc32 = old->crc32;
+    memcpy(entry->sha1, old->sha1, sizeof(entry->sha1));
+  } else {
+    g_thread_pool_push(scan->pool, entry, NULL);
+    scan->changed = true;
+  }
+
+  g_ptr_array_add(catalog->entries, entry);
+  g_ptr_array_add(dir->files, entry);
+}
+
+/**
+ * Scan a directory recursively. A directory whose mtime didn't move still
+ * has the same names in it, so those are taken from the cache instead of
+ * listing it again.
+ */
+static void catalog_scan_dir(Catalog * catalog, CatalogScan * scan, const char * path) {
+  GStatBuf stat;
+  if (g_stat(path, &stat) != 0 || !S_ISDIR(stat.st_mode)) {
+    return;
+  }
+
+  CatalogDir * dir = catalog_dir_new(path, catalog_mtime(&stat));
+  g_ptr_array_add(catalog->dirs, dir);
+
+  CatalogDir * old = g_hash_table_lookup(scan->dirs, path);
+  if (old && old->mtime == dir->mtime) {
+    for (guint i = 0; i < old->files->len; ++i) {
+      CatalogEntry * file = old->files->pdata[i];
+      if (g_stat(file->path, &stat) == 0 && S_ISREG(stat.st_mode)) {
+        catalog_scan_file(catalog, scan, dir, file->path, &stat);
+      } else {
+        scan->changed = true;
+      }
+    }
+
+    for (guint i = 0; i < old->dirs->len; ++i) {
+      char * subdir = old->dirs->pdata[i];
+      g_ptr_array_add(dir->dirs, g_strdup(subdir));
+      catalog_scan_dir(catalog, scan, subdir);
+    }
+    return;
+  }
+
+  scan->changed = true;
+
+  GDir * listing = g_dir_open(path, 0, NULL);
+  if (!listing) {
+    return;
+  }
+
+  const char * file_name;
+  while ((file_name = g_dir_read_name(listing)) != NULL) {
+    if (file_name[0] == '.') {
+      continue;
+    }
+
+    // Symlinked ROMs are followed, symlinked directories could loop forever
+    char * file_path = g_build_filename(path, file_name, NULL);
+    bool link = g_lstat(file_path, &stat) == 0 && S_ISLNK(stat.st_mode);
+    if (g_stat(file_path, &stat) == 0) {
+      if (S_ISREG(stat.st_mode)) {
+        catalog_scan_file(catalog, scan, dir, file_path, &stat);
+      } else if (S_ISDIR(stat.st_mode) && !link) {
+        g_ptr_array_add(dir->dirs, g_strdup(file_path));
+        catalog_scan_dir(catalog, scan, file_path);
+      }
+    }
+    g_free(file_path);
+  }
+
+  g_dir_close(listing);
+}
+
+static void catalog_save(Catalog * catalog);
+
+static void catalog_scan(Catalog * catalog) {
+  CatalogScan scan;
+  scan.dirs = g_hash_table_new(g_str_hash, g_str_equal);
+  scan.files = g_hash_table_new(g_str_hash, g_str_equal);
+  scan.changed = false;
+
+  GPtrArray * old_dirs = catalog->dirs;
+  GPtrArray * old_entries = catalog->entries;
+  for (guint i = 0; i < old_dirs->len; ++i) {
+    CatalogDir * dir = old_dirs->pdata[i];
+    g_hash_table_insert(scan.dirs, dir->path, dir);
+  }
+  for (guint i = 0; i < old_entries->len; ++i) {
+    CatalogEntry * entry = old_entries->pdata[i];
+    g_hash_table_insert(scan.files, entry->path, entry);
+  }
+
+  catalog->dirs = g_ptr_array_new_with_free_func(catalog_dir_free);
+  catalog->entries = g_ptr_array_new_with_free_func(catalog_entry_free);
+
+  catalog_crc32_init();
+  scan.pool = g_thread_pool_new(catalog_hash, NULL, g_get_num_processors(), FALSE, NULL);
+  catalog_scan_dir(catalog, &scan, catalog->root);
+  g_thread_pool_free(scan.pool, FALSE, TRUE);
+
+  // Catches directories that disappeared along with their parent's mtime
+  if (catalog->dirs->len != old_dirs->len) {
+    scan.changed = true;
+  }
+
+  g_hash_table_destroy(scan.dirs);
+  g_hash_table_destroy(scan.files);
+  g_ptr_array_free(old_dirs, TRUE);
+  g_ptr_array_free(old_entries, TRUE);
+
+  if (scan.changed) {
+    catalog_save(catalog);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The cache is a text file with one tab separated record per line. Each
+ * D record is followed by the F records of its files and the S records of
+ * its subdirectories. Paths are escaped so they can't contain tabs or
+ * newlines.
+ *
+ *   nes-emu catalog 1  <root>
+ *   D  <mtime>  <path>
+ *   F  <size>  <mtime>  <valid>  <header>  <crc32>  <sha1>  <path>
+ *   S  <path>
+ */
+
+static char * catalog_canonical_root(Catalog * catalog) {
+  char * root = g_canonicalize_filename(catalog->root, NULL);
+  char * escaped = g_strescape(root, NULL);
+  g_free(root);
+  return escaped;
+}
+
+static bool catalog_load_header(const char * hex, NESHeader * header) {
+  uint8_t * bytes = (uint8_t *)header;
+  if (strlen(hex) != sizeof(NESHeader) * 2) {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(NESHeader); ++i) {
+    int high = g_ascii_xdigit_value(hex[i * 2]);
+    int low = g_ascii_xdigit_value(hex[i * 2 + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    bytes[i] = high << 4 | low;
+  }
+  return true;
+}
+
+static bool catalog_load_line(Catalog * catalog, char ** fields, CatalogDir ** dir) {
+  guint count = g_strv_length(fields);
+
+  if (count == 3 && strcmp(fields[0], "D") == 0) {
+    char * path = g_strcompress(fields[2]);
+    *dir = catalog_dir_new(path, g_ascii_strtoll(fields[1], NULL, 10));
+    g_ptr_array_add(catalog->dirs, *dir);
+    g_free(path);
+    return true;
+  }
+
+  if (!*dir) {
+    return false;
+  }
+
+  if (count == 2 && strcmp(fields[0], "S") == 0) {
+    g_ptr_array_add((*dir)->dirs, g_strcompress(fields[1]));
+    return true;
+  }
+
+  if (count == 8 && strcmp(fields[0], "F") == 0) {
+    char * path = g_strcompress(fields[7]);
+    CatalogEntry * entry = catalog_entry_new(path);
+    g_ptr_array_add(catalog->entries, entry);
+    g_ptr_array_add((*dir)->files, entry);
+    g_free(path);
+
+    entry->size = g_ascii_strtoll(fields[1], NULL, 10);
+    entry->mtime = g_ascii_strtoll(fields[2], NULL, 10);
+    entry->valid = strcmp(fields[3], "1") == 0;
+    entry->crc32 = g_ascii_strtoull(fields[5], NULL, 16);
+    g_strlcpy(entry->sha1, fields[6], sizeof(entry->sha1));
+    return catalog_load_header(fields[4], &entry->header);
+  }
+
+  return false;
+}
+
+// Anything wrong with the cache just means scanning everything again
+static void catalog_load(Catalog * catalog) {
+  char * contents;
+  if (!g_file_get_contents(catalog->cache_path, &contents, NULL, NULL)) {
+    return;
+  }
+
+  char ** lines = g_strsplit(contents, "\n", 0);
+  g_free(contents);
+
+  char * root = catalog_canonical_root(catalog);
+  char * magic = g_strconcat(CATALOG_MAGIC "\t", root, NULL);
+  g_free(root);
+
+  bool valid = lines[0] && strcmp(lines[0], magic) == 0;
+  g_free(magic);
+
+  CatalogDir * dir = NULL;
+  for (int i = 1; valid && lines[i] && lines[i][0]; ++i) {
+    char ** fields = g_strsplit(lines[i], "\t", 0);
+    valid = catalog_load_line(catalog, fields, &dir);
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+
+  if (!valid) {
+    g_ptr_array_set_size(catalog->dirs, 0);
+    g_ptr_array_set_size(catalog->entries, 0);
+  }
+}
+
+static void catalog_save(Catalog * catalog) {
+  GString * out = g_string_new(CATALOG_MAGIC "\t");
+  char * root = catalog_canonical_root(catalog);
+  g_string_append_printf(out, "%s\n", root);
+  g_free(root);
+
+  for (guint i = 0; i < catalog->dirs->len; ++i) {
+    CatalogDir * dir = catalog->dirs->pdata[i];
+    char * path = g_strescape(dir->path, NULL);
+    g_string_append_printf(out, "D\t%" PRId64 "\t%s\n", dir->mtime, path);
+    g_free(path);
+
+    for (guint j = 0; j < dir->files->len; ++j) {
+      CatalogEntry * entry = dir->files->pdata[j];
+      const uint8_t * header = (const uint8_t *)&entry->header;
+
+      g_string_append_printf(out, "F\t%" PRId64 "\t%" PRId64 "\t%d\t", entry->size, entry->mtime, entry->valid);
+      for (size_t k = 0; k < sizeof(NESHeader); ++k) {
+        g_string_append_printf(out, "%02x", header[k]);
+      }
+
+      path = g_strescape(entry->path, NULL);
+      g_string_append_printf(out, "\t%08" PRIx32 "\t%s\t%s\n", entry->crc32, entry->valid ? entry->sha1 : "-", path);
+      g_free(path);
+    }
+
+    for (guint j = 0; j < dir->dirs->len; ++j) {
+      path = g_strescape(dir->dirs->pdata[j], NULL);
+      g_string_append_printf(out, "S\t%s\n", path);
+      g_free(path);
+    }
+  }
+
+  GError * error = NULL;
+  char * cache_dir = g_path_get_dirname(catalog->cache_path);
+  g_mkdir_with_parents(cache_dir, 0777);
+  g_free(cache_dir);
+
+  if (!g_file_set_contents(catalog->cache_path, out->str, out->len, &error)) {
+    fprintf(stderr, "WARNING: Failed to write ROM catalog '%s': %s\n", catalog->cache_path, error->message);
+    g_error_free(error);
+  }
+  g_string_free(out, TRUE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static gint catalog_compare(gconstpointer a, gconstpointer b) {
+  const CatalogEntry * const * entry_a = a;
+  const CatalogEntry * const * entry_b = b;
+  return strcmp((*entry_a)->path, (*entry_b)->path);
+}
+
+Catalog * catalog_open(const char * root, const char * cache_path) {
+  Catalog * catalog = g_malloc0(sizeof(Catalog));
+  catalog->root = g_strdup(root);
+  catalog->cache_path = g_strdup(cache_path);
+  catalog->dirs = g_ptr_array_new_with_free_func(catalog_dir_free);
+  catalog->entries = g_ptr_array_new_with_free_func(catalog_entry_free);
+
+  catalog_load(catalog);
+  catalog_scan(catalog);
+
+  catalog->roms = g_ptr_array_new();
+  for (guint i = 0; i < catalog->entries->len; ++i) {
+    CatalogEntry * entry = catalog->entries->pdata[i];
+    if (entry->valid) {
+      g_ptr_array_add(catalog->roms, entry);
+    }
+  }
+  g_ptr_array_sort(catalog->roms, catalog_compare);
+
+  return catalog;
+}
+
+void catalog_close(Catalog * catalog) {
+  g_ptr_array_free(catalog->roms, TRUE);
+  g_ptr_array_free(catalog->dirs, TRUE);
+  g_ptr_array_free(catalog->entries, TRUE);
+  g_free(catalog->cache_path);
+  g_free(catalog->root);
+  g_free(catalog);
+}
+
+unsigned catalog_size(Catalog * catalog) {
+  return catalog->roms->len;
+}
+
+const CatalogEntry * catalog_get(Catalog * catalog, unsigned index) {
+  return index < catalog->roms->len ? catalog->roms->pdata[index] : NULL;
+}
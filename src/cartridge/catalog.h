@@ -0,0 +1,37 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "header.h"
+
+/**
+ * Index of the ROM files under a directory, kept in a cache file
+ *
+ * Opening a catalog loads the cache and only rescans what changed since:
+ * directories are listed again when their mtime moved, and files are read
+ * again when their size or mtime did. Changed files are hashed in parallel.
+ * Files without an iNES header are remembered too, but not listed.
+ */
+
+typedef struct CatalogEntry {
+  char * path;
+  int64_t size;
+  int64_t mtime;    // Nanoseconds
+  bool valid;       // Has an iNES header
+  NESHeader header;
+  uint32_t crc32;   // Of everything after the header
+  char sha1[41];    // Same, in hex
+} CatalogEntry;
+
+typedef struct Catalog Catalog;
+
+Catalog * catalog_open(const char * root, const char * cache_path);
+void catalog_close(Catalog * catalog);
+
+// Valid ROMs, sorted by path
+unsigned catalog_size(Catalog * catalog);
+const CatalogEntry * catalog_get(Catalog * catalog, unsigned index);
+
+#endif
@@ -0,0 +1,80 @@
+#include "header.h"
+
+/**
+ * NES 2.0 ROM sizes count 16 KB (PRG) or 8 KB (CHR) units, unless the
+ * high nibble is all ones, then the low byte is an exponent and multiplier
+ */
+static bool header_rom_size(uint8_t low, uint8_t high, size_t unit, size_t * size) {
+  if (high != 0x0F) {
+    *size = (size_t)(high << 8 | low) * unit;
+    return true;
+  }
+
+  int exponent = low >> 2;
+  int multiplier = (low & 0x03) * 2 + 1;
+  if (exponent > 26) {
+    return false;
+  }
+  *size = ((size_t)1 << exponent) * multiplier;
+  return true;
+}
+
+static size_t header_ram_size(uint8_t shift) {
+  return shift ? (size_t)64 << shift : 0;
+}
+
+/**
+ * Work out the board from an iNES or NES 2.0 header. Fails on a bad magic
+ * number and on sizes too large to load.
+ */
+bool header_layout(const NESHeader * header, NESLayout * layout) {
+  const uint8_t * bytes = (const uint8_t *)header;
+  if (!header_valid(header)) {
+    return false;
+  }
+
+  layout->nes2 = header->version == 2;
+  layout->trainer = header->trainer;
+  layout->mirror_vert = header->mirror_vert;
+  layout->mirror_quad = header->mirror_quad;
+  layout->mapper = header->mapper_high << 4 | header->mapper_low;
+
+  if (layout->nes2) {
+    layout->mapper |= header->mapper_ext << 8;
+    layout->submapper = header->submapper;
+    layout->timing = header->timing;
+
+    if (!header_rom_size(header->prg_rom_size, header->prg_rom_high, 0x4000, &layout->prg_rom_size) ||
+        !header_rom_size(header->chr_rom_size, header->chr_rom_high, 0x2000, &layout->chr_rom_size)) {
+      return false;
+    }
+
+    layout->prg_ram_size = header_ram_size(header->prg_ram_shift);
+    layout->prg_nvram_size = header_ram_size(header->prg_nvram_shift);
+    layout->chr_ram_size = header_ram_size(header->chr_ram_shift);
+    layout->chr_nvram_size = header_ram_size(header->chr_nvram_shift);
+
+  } else {
+    // Old dumping tools left their name in bytes 7-15, which makes for
+    // nonsense in the high mapper nibble and the PRG RAM size
+    uint8_t prg_ram_banks = bytes[8];
+    if (bytes[12] || bytes[13] || bytes[14] || bytes[15]) {
+      layout->mapper = header->mapper_low;
+      prg_ram_banks = 0;
+    }
+
+    layout->submapper = 0;
+    layout->timing = TIMING_NTSC;
+    layout->prg_rom_size = (size_t)header->prg_rom_size << 14;
+    layout->chr_rom_size = (size_t)header->chr_rom_size << 13;
+
+    // Zero means 8 KB for compatibility, whether or not the board has any
+    size_t prg_ram_size = (prg_ram_banks ? prg_ram_banks : 1) * 0x2000;
+    layout->prg_ram_size = header->prg_ram ? 0 : prg_ram_size;
+    layout->prg_nvram_size = header->prg_ram ? prg_ram_size : 0;
+    layout->chr_ram_size = header->chr_rom_size ? 0 : 0x2000;
+    layout->chr_nvram_size = 0;
+  }
+
+  return true;
+}
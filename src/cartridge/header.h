@@ -0,0 +1,82 @@
+#ifndef HEADER_H
+#define HEADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * iNES header, and the NES 2.0 extension of it when version is 2
+ *
+ * Reference: http://wiki.nesdev.com/w/index.php/NES_2.0
+ */
+typedef struct NESHeader {
+  uint8_t magic[4];
+  uint8_t prg_rom_size; // Low byte in NES 2.0
+  uint8_t chr_rom_size;
+
+  // Flags 6
+  uint8_t mirror_vert  : 1;
+  uint8_t prg_ram      : 1;
+  uint8_t trainer      : 1;
+  uint8_t mirror_quad  : 1;
+  uint8_t mapper_low   : 4;
+
+  // Flags 7
+  uint8_t vs_unisystem : 1;
+  uint8_t playchoice10 : 1;
+  uint8_t version      : 2;
+  uint8_t mapper_high  : 4;
+
+  // The rest is NES 2.0 only, iNES has the PRG RAM size in 8 KB units here
+  uint8_t mapper_ext   : 4;
+  uint8_t submapper    : 4;
+
+  uint8_t prg_rom_high : 4;
+  uint8_t chr_rom_high : 4;
+
+  uint8_t prg_ram_shift   : 4; // 64 << shift bytes, none when 0
+  uint8_t prg_nvram_shift : 4;
+  uint8_t chr_ram_shift   : 4;
+  uint8_t chr_nvram_shift : 4;
+
+  uint8_t timing : 2;
+  uint8_t        : 6;
+
+  uint8_t zero[3];
+} NESHeader;
+
+typedef enum {
+  TIMING_NTSC,
+  TIMING_PAL,
+  TIMING_MULTI,
+  TIMING_DENDY
+} Timing;
+
+// What the header says is on the board, sizes in bytes
+typedef struct NESLayout {
+  bool nes2;
+  int mapper;
+  int submapper;
+  Timing timing;
+  bool trainer;
+  bool mirror_vert;
+  bool mirror_quad;
+
+  size_t prg_rom_size;
+  size_t chr_rom_size;
+  size_t prg_ram_size;
+  size_t prg_nvram_size;
+  size_t chr_ram_size;
+  size_t chr_nvram_size;
+} NESLayout;
+
+static inline bool header_valid(const NESHeader * header) {
+  static const uint8_t nes_magic[] = {'N', 'E', 'S', 0x1A};
+  return memcmp(header->magic, nes_magic, 4) == 0;
+}
+
+bool header_layout(const NESHeader * header, NESLayout * layout);
+
+#endif
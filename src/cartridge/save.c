@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <glib.h>
+
+#include "save.h"
+
+// Writes are coalesced so a game using its save RAM as work RAM doesn't
+// rewrite the file every frame
+#define SAVE_INTERVAL G_TIME_SPAN_SECOND
+
+struct Save {
+  char * path;
+  size_t size;
+
+  GMappedFile * mapping; // NULL when there was no usable file
+  uint8_t * ram;         // Points into the mapping, or allocated
+  uint8_t * saved;       // Contents as of the last snapshot
+
+  GThread * thread;
+  GMutex mutex;
+  GCond cond;
+  uint8_t * pending;     // Snapshot waiting to be written
+  bool queued;
+  bool quit;
+};
+
+static void save_write(Save * save, const uint8_t * data) {
+  GError * error = NULL;
+  GFileSetContentsFlags flags = G_FILE_SET_CONTENTS_CONSISTENT | G_FILE_SET_CONTENTS_DURABLE;
+  if (!g_file_set_contents_full(save->path, (const char *)data, save->size, flags, 0666, &error)) {
+    fprintf(stderr, "ERROR: Failed to write save file '%s': %s\n", save->path, error->message);
+    g_error_free(error);
+  }
+}
+
+static gpointer save_thread(gpointer data) {
+  Save * save = data;
+  uint8_t * buffer = g_malloc(save->size);
+
+  g_mutex_lock(&save->mutex);
+  while (true) {
+    while (!save->queued && !save->quit) {
+      g_cond_wait(&save->cond, &save->mutex);
+    }
+    if (!save->queued) {
+      break;
+    }
+
+    memcpy(buffer, save->pending, save->size);
+    save->queued = false;
+
+    g_mutex_unlock(&save->mutex);
+    save_write(save, buffer);
+    g_mutex_lock(&save->mutex);
+
+    // Let more changes pile up, unless the save is being closed
+    gint64 next = g_get_monotonic_time() + SAVE_INTERVAL;
+    while (!save->quit) {
+      if (!g_cond_wait_until(&save->cond, &save->mutex, next)) {
+        break;
+      }
+    }
+  }
+  g_mutex_unlock(&save->mutex);
+
+  g_free(buffer);
+  return NULL;
+}
+
+Save * save_open(const char * path, size_t size) {
+  Save * save = g_malloc0(sizeof(Save));
+  save->path = g_strdup(path);
+  save->size = size;
+
+  // Only a file of the right size can be mapped, anything else starts over
+  save->mapping = g_mapped_file_new(path, TRUE, NULL);
+  if (save->mapping && g_mapped_file_get_length(save->mapping) == size) {
+    save->ram = (uint8_t *)g_mapped_file_get_contents(save->mapping);
+  } else {
+    if (save->mapping) {
+      g_mapped_file_unref(save->mapping);
+      save->mapping = NULL;
+    }
+    save->ram = g_malloc0(size);
+  }
+
+  save->saved = g_malloc(size);
+  save->pending = g_malloc(size);
+  memcpy(save->saved, save->ram, size);
+
+  g_mutex_init(&save->mutex);
+  g_cond_init(&save->cond);
+  save->thread = g_thread_new("save", save_thread, save);
+  return save;
+}
+
+// Write out any last changes and wait for the file to be replaced
+void save_close(Save * save) {
+  save_sync(save);
+
+  g_mutex_lock(&save->mutex);
+  save->quit = true;
+  g_cond_signal(&save->cond);
+  g_mutex_unlock(&save->mutex);
+  g_thread_join(save->thread);
+
+  g_mutex_clear(&save->mutex);
+  g_cond_clear(&save->cond);
+
+  if (save->mapping) {
+    g_mapped_file_unref(save->mapping);
+  } else {
+    g_free(save->ram);
+  }
+  g_free(save->saved);
+  g_free(save->pending);
+  g_free(save->path);
+  g_free(save);
+}
+
+uint8_t * save_ram(Save * save) {
+  return save->ram;
+}
+
+/**
+ * Queue the RAM for writing if it changed since the last call. Never waits
+ * on I/O, the writer thread only holds the lock to copy the snapshot.
+ */
+void save_sync(Save * save) {
+  if (memcmp(save->ram, save->saved, save->size) == 0) {
+    return;
+  }
+  memcpy(save->saved, save->ram, save->size);
+
+  g_mutex_lock(&save->mutex);
+  memcpy(save->pending, save->ram, save->size);
+  save->queued = true;
+  g_cond_signal(&save->cond);
+  g_mutex_unlock(&save->mutex);
+}
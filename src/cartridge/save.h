@@ -0,0 +1,27 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Battery backed save RAM, kept in a .sav file next to the ROM
+ *
+ * An existing file is mapped privately, so loading doesn't copy it and
+ * the emulator never writes to it directly. save_sync is called between
+ * frames in which the CPU wrote to the RAM. It compares the RAM with the
+ * last snapshot, and hands a new one to a background thread if they
+ * differ. The thread replaces the file with a new one that has been
+ * written out and synced before it's renamed into place, so a crash leaves
+ * either the previous save or the new one, never a mix of the two.
+ */
+
+typedef struct Save Save;
+
+Save * save_open(const char * path, size_t size);
+void save_close(Save * save);
+
+uint8_t * save_ram(Save * save);
+void save_sync(Save * save);
+
+#endif
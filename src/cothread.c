@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "cothread.h"
+
+/**
+ * On x86-64 the switch only saves the callee-saved registers and swaps
+ * stack pointers. Elsewhere it falls back to ucontext, which also saves
+ * the signal mask on every switch and is much slower for it.
+ */
+#if defined(__x86_64__) && defined(__unix__)
+#define COTHREAD_NATIVE
+#else
+#include <ucontext.h>
+#endif
+
+struct Cothread {
+#ifdef COTHREAD_NATIVE
+  void * sp;
+#else
+  ucontext_t context;
+#endif
+  CothreadEntry entry;
+  void * data;
+  void * stack;
+};
+
+// Each OS thread switches among its own cothreads
+static _Thread_local Cothread cothread_main;
+static _Thread_local Cothread * cothread_current = NULL;
+
+// The OS thread itself the first time it uses cothreads
+Cothread * cothread_active(void) {
+  if (!cothread_current) {
+    cothread_current = &cothread_main;
+  }
+  return cothread_current;
+}
+
+static void cothread_start(void) {
+  Cothread * thread = cothread_active();
+  thread->entry(thread->data);
+
+  fprintf(stderr, "ERROR: Cothread returned from its entry function\n");
+  abort();
+}
+
+#ifdef COTHREAD_NATIVE
+
+// Save the callee-saved registers on the current stack, store the stack
+// pointer in *from, then restore the registers saved on the stack at to
+void cothread_swap(void ** from, void * to);
+__asm__(
+  ".text\n"
+  ".p2align 4\n"
+  "cothread_swap:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+);
+
+// Lay out a stack as if cothread_swap had been called from cothread_start
+static bool cothread_prepare(Cothread * thread, size_t stack_size) {
+  uintptr_t top = ((uintptr_t)thread->stack + stack_size) & ~(uintptr_t)15;
+  void ** sp = (void **)top;
+
+  *--sp = NULL; // return address of cothread_start, keeps it aligned
+  *--sp = (void *)cothread_start;
+  for (int i = 0; i < 6; ++i) {
+    *--sp = NULL;
+  }
+
+  thread->sp = sp;
+  return true;
+}
+
+#else
+
+static bool cothread_prepare(Cothread * thread, size_t stack_size) {
+  if (getcontext(&thread->context) != 0) {
+    return false;
+  }
+
+  thread->context.uc_stack.ss_sp = thread->stack;
+  thread->context.uc_stack.ss_size = stack_size;
+  thread->context.uc_link = NULL;
+  makecontext(&thread->context, cothread_start, 0);
+  return true;
+}
+
+#endif
+
+Cothread * cothread_create(size_t stack_size, CothreadEntry entry, void * data) {
+  Cothread * thread = malloc(sizeof(Cothread));
+  if (!thread) {
+    return NULL;
+  }
+
+  thread->entry = entry;
+  thread->data = data;
+  thread->stack = malloc(stack_size);
+  if (!thread->stack || !cothread_prepare(thread, stack_size)) {
+    free(thread->stack);
+    free(thread);
+    return NULL;
+  }
+
+  return thread;
+}
+
+void cothread_destroy(Cothread * thread) {
+  assert(thread != cothread_active());
+  free(thread->stack);
+  free(thread);
+}
+
+// Suspend the active cothread and resume the given one where it left off
+void cothread_switch(Cothread * thread) {
+  Cothread * previous = cothread_active();
+  if (thread == previous) {
+    return;
+  }
+
+  cothread_current = thread;
+#ifdef COTHREAD_NATIVE
+  cothread_swap(&previous->sp, thread->sp);
+#else
+  swapcontext(&previous->context, &thread->context);
+#endif
+}
@@ -0,0 +1,24 @@
+#ifndef COTHREAD_H
+#define COTHREAD_H
+
+#include <stddef.h>
+
+/**
+ * Cooperative threads with their own stacks
+ *
+ * A cothread runs until it explicitly switches to another one, so there is
+ * no locking and no preemption. An OS thread that calls into this API
+ * becomes a cothread itself and can be switched back to like any other.
+ * Cothreads must only be switched to from the OS thread that runs them.
+ * Entry functions must never return.
+ */
+
+typedef struct Cothread Cothread;
+typedef void (*CothreadEntry)(void * data);
+
+Cothread * cothread_active(void);
+Cothread * cothread_create(size_t stack_size, CothreadEntry entry, void * data);
+void cothread_destroy(Cothread * thread);
+void cothread_switch(Cothread * thread);
+
+#endif
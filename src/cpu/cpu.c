@@ -3,14 +3,17 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "cpu.h"
+#include "jit.h"
 #include "opcode.h"
 #include "array.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "nes.h"
+#include "ppu/compose.h"
 
 // Note: This assumes that the CPU can only exist within a NES.
 // Maybe this coupling is too strong...
@@ -36,17 +39,65 @@ static uint16_t cpu_memory_read16(CPU * cpu, uint16_t addr);
 
 static uint8_t cpu_memory_next(CPU * cpu);
 static uint16_t cpu_memory_next16(CPU * cpu);
+static uint16_t cpu_memory_next_relative(CPU * cpu);
 
 static bool pages_differ(uint16_t orig_addr, uint16_t new_addr);
 
+static void cpu_poll_interrupts(CPU * cpu);
+
+static void cpu_generic_instr(CPU * cpu);
+static void cpu_fused_instr(CPU * cpu);
+static long cpu_threaded_run(CPU * cpu);
+static void cpu_cached_instr(CPU * cpu);
+static void cpu_cached_run(CPU * cpu);
+static void cpu_jit_run(CPU * cpu);
+static CPUCache * cpu_cache_create(void);
+static CPUIdle * cpu_idle_create(void);
+static void cpu_idle_loop(CPU * cpu, uint16_t head, uint16_t end);
+static void cpu_idle_flush(CPU * cpu);
+static void cpu_idle_rebase(CPU * cpu, int cycles);
+
+static Address cpu_addr_implied(CPU * cpu);
+static Address cpu_addr_accumulator(CPU * cpu);
+static Address cpu_addr_immediate(CPU * cpu, uint16_t operand);
+static Address cpu_addr_zero_page(CPU * cpu, uint16_t operand);
+static Address cpu_addr_absolute(CPU * cpu, uint16_t operand);
+static Address cpu_addr_relative(CPU * cpu, uint16_t operand);
+static Address cpu_addr_zero_page_x(CPU * cpu, uint16_t operand);
+static Address cpu_addr_zero_page_y(CPU * cpu, uint16_t operand);
+static Address cpu_addr_absolute_x(CPU * cpu, uint16_t operand, bool * page_crossed);
+static Address cpu_addr_absolute_y(CPU * cpu, uint16_t operand, bool * page_crossed);
+static Address cpu_addr_indirect(CPU * cpu, uint16_t operand);
+static Address cpu_addr_indirect_indexed(CPU * cpu, uint16_t operand, bool * page_crossed);
+static Address cpu_addr_indexed_indirect(CPU * cpu, uint16_t operand);
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void cpu_init(CPU * cpu) {
+  cpu->dispatch = CPU_DISPATCH_CACHED;
+  cpu->cache = cpu_cache_create();
+  cpu->idle = cpu_idle_create();
+  cpu->jit = NULL;
   cpu_reset(cpu);
 }
 
+void cpu_deinit(CPU * cpu) {
+  if (cpu->jit) {
+    jit_destroy(cpu->jit);
+    cpu->jit = NULL;
+  }
+  free(cpu->cache);
+  free(cpu->idle);
+  cpu->cache = NULL;
+  cpu->idle = NULL;
+}
+
 void cpu_reset(CPU * cpu) {
   cpu->clock = 0;
+  cpu->deadline = 0;
+  cpu->irq = 0;
+  cpu->nmi = false;
+  cpu_cache_flush(cpu);
 
   cpu->pc = cpu_memory_read16(cpu, 0xFFFC);
   cpu->sp = 0xFD;
@@ -60,55 +111,132 @@ void cpu_reset(CPU * cpu) {
 
 // Evaluate the next instruction in the program
 void cpu_next_instr(CPU * cpu) {
+  cpu_poll_interrupts(cpu);
+
+  switch (cpu->dispatch) {
+  case CPU_DISPATCH_GENERIC:
+    cpu_generic_instr(cpu);
+    break;
+  case CPU_DISPATCH_FUSED:
+    cpu_fused_instr(cpu);
+    break;
+  case CPU_DISPATCH_CACHED:
+  case CPU_DISPATCH_JIT:
+    cpu_cached_instr(cpu);
+    break;
+  }
+}
+
+/**
+ * Run instructions until at least the given number of cycles have elapsed,
+ * or until an event calls cpu_yield. Returns the number of cycles executed,
+ * which may overshoot by the length of the last instruction.
+ */
+int cpu_run(CPU * cpu, int cycles) {
+  int start = cpu->clock;
+  cpu->deadline = start + cycles;
+  cpu_poll_interrupts(cpu);
+
+  switch (cpu->dispatch) {
+  case CPU_DISPATCH_GENERIC:
+    while (cpu->clock < cpu->deadline) {
+      cpu_generic_instr(cpu);
+    }
+    break;
+  case CPU_DISPATCH_FUSED:
+    cpu_threaded_run(cpu);
+    break;
+  case CPU_DISPATCH_CACHED:
+    cpu_cached_run(cpu);
+    break;
+  case CPU_DISPATCH_JIT:
+    cpu_jit_run(cpu);
+    break;
+  }
+
+  return cpu->clock - start;
+}
+
+// Stop cpu_run after the current instruction
+void cpu_yield(CPU * cpu) {
+  cpu->deadline = cpu->clock;
+}
+
+// Move the clock back by some cycles, along with every time kept against it
+void cpu_rebase(CPU * cpu, int cycles) {
+  cpu->clock -= cycles;
+  cpu->deadline -= cycles;
+  cpu_idle_rebase(cpu, cycles);
+}
+
+/**
+ * Drive the IRQ line on behalf of a device. Interrupts are only checked
+ * for when cpu_run starts, so anything that could let one through stops
+ * the run: the line going active, or the I flag being cleared under it.
+ */
+void cpu_irq(CPU * cpu, CPUIRQ source, bool active) {
+  if (active) {
+    cpu->irq |= source;
+    if (!cpu->i) {
+      cpu_yield(cpu);
+    }
+  } else {
+    cpu->irq &= ~source;
+  }
+}
+
+// Pull the NMI line, which can't be masked
+void cpu_nmi(CPU * cpu) {
+  cpu->nmi = true;
+  cpu_yield(cpu);
+}
+
+// Decode the instruction through the opcode tables
+static void cpu_generic_instr(CPU * cpu) {
   uint8_t opcode = cpu_memory_next(cpu);
   Instruction instruction = opcode_instruction[opcode];
 
-  Address addr = {
-    .val = 0,
-    .null = false
-  };
-
+  Address addr;
   bool page_crossed = false;
   switch (opcode_addressing_mode[opcode]) {
   case ADDR_IMPLIED:
+    addr = cpu_addr_implied(cpu);
+    break;
   case ADDR_ACCUMULATOR:
-    addr.null = true;
+    addr = cpu_addr_accumulator(cpu);
     break;
   case ADDR_IMMEDIATE:
-    addr.val = cpu->pc++;
+    addr = cpu_addr_immediate(cpu, cpu->pc++);
     break;
   case ADDR_ZERO_PAGE:
-    addr.val = cpu_memory_next(cpu);
+    addr = cpu_addr_zero_page(cpu, cpu_memory_next(cpu));
     break;
   case ADDR_ABSOLUTE:
-    addr.val = cpu_memory_next16(cpu);
+    addr = cpu_addr_absolute(cpu, cpu_memory_next16(cpu));
     break;
   case ADDR_RELATIVE:
-    addr.val = cpu_memory_next(cpu) + cpu->pc;
+    addr = cpu_addr_relative(cpu, cpu_memory_next_relative(cpu));
     break;
   case ADDR_ZERO_PAGE_X:
-    addr.val = (uint8_t)(cpu_memory_next(cpu) + cpu->x);
+    addr = cpu_addr_zero_page_x(cpu, cpu_memory_next(cpu));
     break;
   case ADDR_ZERO_PAGE_Y:
-    addr.val = (uint8_t)(cpu_memory_next(cpu) + cpu->y);
+    addr = cpu_addr_zero_page_y(cpu, cpu_memory_next(cpu));
     break;
   case ADDR_ABSOLUTE_X:
-    addr.val = cpu_memory_next16(cpu) + cpu->x;
-    page_crossed = pages_differ(addr.val - cpu->x, addr.val);
+    addr = cpu_addr_absolute_x(cpu, cpu_memory_next16(cpu), &page_crossed);
     break;
   case ADDR_ABSOLUTE_Y:
-    addr.val = cpu_memory_next16(cpu) + cpu->y;
-    page_crossed = pages_differ(addr.val - cpu->y, addr.val);
+    addr = cpu_addr_absolute_y(cpu, cpu_memory_next16(cpu), &page_crossed);
     break;
   case ADDR_INDIRECT:
-    addr.val = cpu_memory_read16(cpu, cpu_memory_next16(cpu));
+    addr = cpu_addr_indirect(cpu, cpu_memory_next16(cpu));
     break;
   case ADDR_INDIRECT_INDEXED:
-    addr.val = cpu_memory_zero_page_read16(cpu, cpu_memory_next(cpu)) + cpu->y;
-    page_crossed = pages_differ(addr.val - cpu->y, addr.val);
+    addr = cpu_addr_indirect_indexed(cpu, cpu_memory_next(cpu), &page_crossed);
     break;
   case ADDR_INDEXED_INDIRECT:
-    addr.val = cpu_memory_zero_page_read16(cpu, cpu_memory_next(cpu) + cpu->x);
+    addr = cpu_addr_indexed_indirect(cpu, cpu_memory_next(cpu));
     break;
   }
 
@@ -122,25 +250,37 @@ void cpu_next_instr(CPU * cpu) {
 /*
  * Registers
  */
+static bool cpu_flag_z(CPU * cpu) {
+  return cpu->z_result == 0;
+}
+
+static bool cpu_flag_n(CPU * cpu) {
+  return cpu->n_result >> 7;
+}
+
+static bool cpu_flag_v(CPU * cpu) {
+  return cpu->v_result >> 7;
+}
+
 static void cpu_status_write(CPU * cpu, uint8_t val) {
-  cpu->c = val >> 0;
-  cpu->z = val >> 1;
+  cpu->c = val >> 0 & 1;
+  cpu->z_result = ~val >> 1 & 1;
   cpu->i = val >> 2;
   cpu->d = val >> 3;
-  cpu->v = val >> 6;
-  cpu->n = val >> 7;
+  cpu->v_result = val << 1;
+  cpu->n_result = val;
 }
 
 static uint8_t cpu_status_read(CPU * cpu) {
   uint8_t val = 0x00;
   val |= cpu->c << 0;
-  val |= cpu->z << 1;
+  val |= cpu_flag_z(cpu) << 1;
   val |= cpu->i << 2;
   val |= cpu->d << 3;
   val |= 1 << 4;
   val |= 1 << 5;
-  val |= cpu->v << 6;
-  val |= cpu->n << 7;
+  val |= cpu_flag_v(cpu) << 6;
+  val |= cpu_flag_n(cpu) << 7;
   return val;
 }
 
@@ -153,6 +293,7 @@ static uint8_t cpu_memory_read(CPU * cpu, uint16_t addr) {
 
 static void cpu_memory_write(CPU * cpu, uint16_t addr, uint8_t val) {
   memory_write(cpu_mem(cpu), addr, val);
+  cpu_cache_write(cpu, addr);
 }
 
 static uint16_t cpu_memory_read16(CPU * cpu, uint16_t addr) {
@@ -186,10 +327,88 @@ static uint16_t cpu_memory_next16(CPU * cpu) {
   return addr;
 }
 
+// Branch target relative to the following instruction
+static uint16_t cpu_memory_next_relative(CPU * cpu) {
+  int8_t offset = cpu_memory_next(cpu);
+  return cpu->pc + offset;
+}
+
 static bool pages_differ(uint16_t orig_addr, uint16_t new_addr) {
   return (orig_addr & 0xFF00) != (new_addr & 0xFF00);
 }
 
+/*
+ * Addressing modes
+ */
+static Address cpu_addr_implied(CPU * cpu) {
+  (void)cpu;
+  return (Address){.val = 0, .null = true};
+}
+
+static Address cpu_addr_accumulator(CPU * cpu) {
+  (void)cpu;
+  return (Address){.val = 0, .null = true};
+}
+
+static Address cpu_addr_immediate(CPU * cpu, uint16_t operand) {
+  (void)cpu;
+  return (Address){.val = operand, .null = false};
+}
+
+static Address cpu_addr_zero_page(CPU * cpu, uint16_t operand) {
+  (void)cpu;
+  return (Address){.val = operand, .null = false};
+}
+
+static Address cpu_addr_absolute(CPU * cpu, uint16_t operand) {
+  (void)cpu;
+  return (Address){.val = operand, .null = false};
+}
+
+static Address cpu_addr_relative(CPU * cpu, uint16_t operand) {
+  (void)cpu;
+  return (Address){.val = operand, .null = false};
+}
+
+static Address cpu_addr_zero_page_x(CPU * cpu, uint16_t operand) {
+  uint16_t val = (uint8_t)(operand + cpu->x);
+  return (Address){.val = val, .null = false};
+}
+
+static Address cpu_addr_zero_page_y(CPU * cpu, uint16_t operand) {
+  uint16_t val = (uint8_t)(operand + cpu->y);
+  return (Address){.val = val, .null = false};
+}
+
+static Address cpu_addr_absolute_x(CPU * cpu, uint16_t operand, bool * page_crossed) {
+  uint16_t val = operand + cpu->x;
+  *page_crossed = pages_differ(operand, val);
+  return (Address){.val = val, .null = false};
+}
+
+static Address cpu_addr_absolute_y(CPU * cpu, uint16_t operand, bool * page_crossed) {
+  uint16_t val = operand + cpu->y;
+  *page_crossed = pages_differ(operand, val);
+  return (Address){.val = val, .null = false};
+}
+
+static Address cpu_addr_indirect(CPU * cpu, uint16_t operand) {
+  uint16_t val = cpu_memory_read16(cpu, operand);
+  return (Address){.val = val, .null = false};
+}
+
+static Address cpu_addr_indirect_indexed(CPU * cpu, uint16_t operand, bool * page_crossed) {
+  uint16_t base = cpu_memory_zero_page_read16(cpu, operand);
+  uint16_t val = base + cpu->y;
+  *page_crossed = pages_differ(base, val);
+  return (Address){.val = val, .null = false};
+}
+
+static Address cpu_addr_indexed_indirect(CPU * cpu, uint16_t operand) {
+  uint16_t val = cpu_memory_zero_page_read16(cpu, operand + cpu->x);
+  return (Address){.val = val, .null = false};
+}
+
 /*
  * Stack operations
  */
@@ -215,6 +434,27 @@ static uint16_t cpu_pull16(CPU * cpu) {
   return val;
 }
 
+/*
+ * Interrupts
+ */
+static void cpu_interrupt(CPU * cpu, uint16_t vector) {
+  // Like BRK, but the B flag pushed is clear and PC isn't skipped ahead
+  cpu_push16(cpu, cpu->pc);
+  cpu_push(cpu, cpu_status_read(cpu) & ~0x10);
+  cpu->i = 1;
+  cpu->pc = cpu_memory_read16(cpu, vector);
+  cpu->clock += 7;
+}
+
+static void cpu_poll_interrupts(CPU * cpu) {
+  if (cpu->nmi) {
+    cpu->nmi = false;
+    cpu_interrupt(cpu, 0xFFFA);
+  } else if (cpu->irq && !cpu->i) {
+    cpu_interrupt(cpu, 0xFFFE);
+  }
+}
+
 /**
  * Branching
  */
@@ -224,15 +464,19 @@ static void cpu_branch(CPU * cpu, Address addr) {
     cpu->clock++;
   }
 
+  uint16_t end = cpu->pc;
   cpu->pc = addr.val;
+  if (addr.val < end) {
+    cpu_idle_loop(cpu, addr.val, end);
+  }
 }
 
 /**
  * Value operations
  */
 static void cpu_zn(CPU * cpu, uint8_t val) {
-  cpu->z = val == 0;
-  cpu->n = val >> 7 & 1;
+  cpu->z_result = val;
+  cpu->n_result = val;
 }
 
 static void cpu_compare(CPU * cpu, uint8_t a, uint8_t b) {
@@ -251,7 +495,7 @@ void cpu_adc(CPU * cpu, Address addr) {
   uint16_t result = a + b + cpu->c;
   cpu->a = result;
   cpu->c = result > 0xFF;
-  cpu->v = !((a^b) >> 7 & 1) && ((result^a) >> 7 & 1);
+  cpu->v_result = ~(a^b) & (result^a);
   cpu_zn(cpu, result);
 }
 
@@ -292,32 +536,32 @@ void cpu_bcs(CPU * cpu, Address addr) {
 }
 
 void cpu_beq(CPU * cpu, Address addr) {
-  if (cpu->z) {
+  if (cpu_flag_z(cpu)) {
     cpu_branch(cpu, addr);
   }
 }
 
 void cpu_bit(CPU * cpu, Address addr) {
   uint8_t val = cpu_memory_read(cpu, addr.val);
-  cpu->z = (val & cpu->a) == 0;
-  cpu->v = val >> 6 & 1;
-  cpu->n = val >> 7 & 1;
+  cpu->z_result = val & cpu->a;
+  cpu->v_result = val << 1;
+  cpu->n_result = val;
 }
 
 void cpu_bmi(CPU * cpu, Address addr) {
-  if (cpu->n) {
+  if (cpu_flag_n(cpu)) {
     cpu_branch(cpu, addr);
   }
 }
 
 void cpu_bne(CPU * cpu, Address addr) {
-  if (!cpu->z) {
+  if (!cpu_flag_z(cpu)) {
     cpu_branch(cpu, addr);
   }
 }
 
 void cpu_bpl(CPU * cpu, Address addr) {
-  if (!cpu->n) {
+  if (!cpu_flag_n(cpu)) {
     cpu_branch(cpu, addr);
   }
 }
@@ -334,13 +578,13 @@ void cpu_brk(CPU * cpu, Address addr) {
 }
 
 void cpu_bvc(CPU * cpu, Address addr) {
-  if (!cpu->v) {
+  if (!cpu_flag_v(cpu)) {
     cpu_branch(cpu, addr);
   }
 }
 
 void cpu_bvs(CPU * cpu, Address addr) {
-  if (cpu->v) {
+  if (cpu_flag_v(cpu)) {
     cpu_branch(cpu, addr);
   }
 }
@@ -358,11 +602,14 @@ void cpu_cld(CPU * cpu, Address addr) {
 void cpu_cli(CPU * cpu, Address addr) {
   (void)addr;
   cpu->i = 0;
+  if (cpu->irq) {
+    cpu_yield(cpu);
+  }
 }
 
 void cpu_clv(CPU * cpu, Address addr) {
   (void)addr;
-  cpu->v = 0;
+  cpu->v_result = 0;
 }
 
 void cpu_cmp(CPU * cpu, Address addr) {
@@ -515,6 +762,9 @@ void cpu_pla(CPU * cpu, Address addr) {
 void cpu_plp(CPU * cpu, Address addr) {
   (void)addr;
   cpu_status_write(cpu, cpu_pull(cpu));
+  if (cpu->irq && !cpu->i) {
+    cpu_yield(cpu);
+  }
 }
 
 void cpu_rol(CPU * cpu, Address addr) {
@@ -574,7 +824,7 @@ void cpu_sbc(CPU * cpu, Address addr) {
   int16_t result = a - b - (1 - cpu->c);
   cpu->a = result;
   cpu->c = result >= 0x00;
-  cpu->v = ((a^b) >> 7 & 1) && ((result^a) >> 7 & 1);
+  cpu->v_result = (a^b) & (result^a);
   cpu_zn(cpu, result);
 }
 
@@ -768,6 +1018,625 @@ void cpu_xaa(CPU * cpu, Address addr) {
   cpu_unofficial(cpu, "XAA");
 }
 
+/*
+ * Fused opcode handlers
+ *
+ * One handler per opcode with the addressing mode and cycle cost baked in,
+ * generated at build time by opcode-gen.c from the tables in opcode.h.
+ */
+#include "cpu/opcode-handlers.h"
+
+static void cpu_fused_instr(CPU * cpu) {
+  opcode_handler[cpu_memory_next(cpu)](cpu);
+}
+
+/*
+ * Threaded code
+ *
+ * Every opcode gets its own copy of the dispatch jump, so the branch
+ * predictor can learn which opcode tends to follow which.
+ */
+#ifdef __GNUC__
+static long cpu_threaded_run(CPU * cpu) {
+#define OPCODE_LABEL(op) &&opcode_##op,
+  static void * const opcode_label[256] = {
+    OPCODE_LIST(OPCODE_LABEL)
+  };
+#undef OPCODE_LABEL
+
+  // Instructions run, for cpu_debug_bench
+  long count = 0;
+
+#define DISPATCH()                              \
+  if (cpu->clock >= cpu->deadline) {            \
+    return count;                               \
+  }                                             \
+  count++;                                      \
+  goto *opcode_label[cpu_memory_next(cpu)]
+
+  DISPATCH();
+
+#define OPCODE_CASE(op)                         \
+  opcode_##op:                                  \
+    cpu_opcode_##op(cpu);                       \
+    DISPATCH();
+
+  OPCODE_LIST(OPCODE_CASE)
+#undef OPCODE_CASE
+#undef DISPATCH
+}
+#else
+static long cpu_threaded_run(CPU * cpu) {
+  long count = 0;
+  while (cpu->clock < cpu->deadline) {
+    cpu_fused_instr(cpu);
+    count++;
+  }
+  return count;
+}
+#endif
+
+/*
+ * Decoded instruction cache
+ *
+ * Instructions are decoded once per address and replayed from the cache,
+ * skipping the opcode and operand fetches through the memory map. Only
+ * RAM and the cartridge space above $6000 can hold code. Each cartridge
+ * window has a generation that is bumped whenever the mapper may have
+ * switched banks, which drops every entry decoded under the old mapping.
+ */
+#define CPU_CACHE_SRAM 0x6000
+#define CPU_CACHE_WINDOW_SIZE 0x2000
+#define CPU_CACHE_WINDOWS (1 + (0x10000 - CPU_CACHE_SRAM) / CPU_CACHE_WINDOW_SIZE)
+#define CPU_CACHE_SIZE (MEMORY_RAM_SIZE + 0x10000 - CPU_CACHE_SRAM)
+
+typedef struct {
+  uint16_t operand;
+  uint8_t opcode;
+  uint8_t cycles;
+  uint8_t length;
+  uint16_t generation; // 0 is never valid
+  uint16_t pc;         // decoded at, RAM mirrors share entries
+} CPUCacheEntry;
+
+struct CPUCache {
+  uint16_t generation[CPU_CACHE_WINDOWS]; // RAM, then each cartridge window
+  unsigned writes;                        // memory writes seen, see cpu_idle_loop
+  CPUCacheEntry entries[CPU_CACHE_SIZE];
+};
+
+static CPUCache * cpu_cache_create(void) {
+  CPUCache * cache = malloc(sizeof(CPUCache));
+  if (cache == NULL) {
+    fprintf(stderr, "Failed to allocate instruction cache\n");
+    exit(1);
+  }
+
+  return cache;
+}
+
+// Find the window and cache index of an address, false if it can't hold code
+static bool cpu_cache_index(uint16_t addr, int * window, int * index) {
+  if (addr <= MEMORY_RAM_END) {
+    *window = 0;
+    *index = addr % MEMORY_RAM_SIZE;
+    return true;
+  } else if (addr >= CPU_CACHE_SRAM) {
+    *window = 1 + (addr - CPU_CACHE_SRAM) / CPU_CACHE_WINDOW_SIZE;
+    *index = MEMORY_RAM_SIZE + (addr - CPU_CACHE_SRAM);
+    return true;
+  }
+
+  return false;
+}
+
+static void cpu_cache_decode(CPU * cpu, CPUCacheEntry * entry, uint16_t pc) {
+  uint8_t opcode = cpu_memory_read(cpu, pc);
+  entry->opcode = opcode;
+  entry->cycles = opcode_cycles[opcode];
+  entry->length = opcode_length[opcode];
+
+  switch (opcode_addressing_mode[opcode]) {
+  case ADDR_IMPLIED:
+  case ADDR_ACCUMULATOR:
+    entry->operand = 0;
+    break;
+  case ADDR_IMMEDIATE:
+    entry->operand = pc + 1;
+    break;
+  case ADDR_RELATIVE:
+    entry->operand = pc + 2 + (int8_t)cpu_memory_read(cpu, pc + 1);
+    break;
+  case ADDR_ZERO_PAGE:
+  case ADDR_ZERO_PAGE_X:
+  case ADDR_ZERO_PAGE_Y:
+  case ADDR_INDIRECT_INDEXED:
+  case ADDR_INDEXED_INDIRECT:
+    entry->operand = cpu_memory_read(cpu, pc + 1);
+    break;
+  case ADDR_ABSOLUTE:
+  case ADDR_ABSOLUTE_X:
+  case ADDR_ABSOLUTE_Y:
+  case ADDR_INDIRECT:
+    entry->operand = cpu_memory_read16(cpu, pc + 1);
+    break;
+  }
+}
+
+static CPUCacheEntry * cpu_cache_lookup(CPU * cpu, uint16_t pc) {
+  int window, index;
+  if (!cpu_cache_index(pc, &window, &index)) {
+    return NULL;
+  }
+
+  CPUCache * cache = cpu->cache;
+  CPUCacheEntry * entry = &cache->entries[index];
+  // Branch targets are absolute, so code run from another RAM mirror
+  // has to be decoded again
+  if (entry->generation != cache->generation[window] || entry->pc != pc) {
+    cpu_cache_decode(cpu, entry, pc);
+    entry->generation = cache->generation[window];
+    entry->pc = pc;
+  }
+
+  return entry;
+}
+
+static void cpu_cache_invalidate(CPUCache * cache, int index, int first) {
+  for (int i = index; i >= first && i > index - 3; --i) {
+    cache->entries[i].generation = 0;
+  }
+}
+
+static void cpu_cache_bump(CPUCache * cache, int window) {
+  if (++cache->generation[window] == 0) {
+    int start = MEMORY_RAM_SIZE + (window - 1) * CPU_CACHE_WINDOW_SIZE;
+    for (int i = start; i < start + CPU_CACHE_WINDOW_SIZE; ++i) {
+      cache->entries[i].generation = 0;
+    }
+    cache->generation[window] = 1;
+  }
+}
+
+/**
+ * Called on every CPU bus write. Writes to RAM and SRAM drop the
+ * instructions that may contain the written byte. Writes to the mapper
+ * registers don't change the cartridge by themselves, bank switches are
+ * reported through cpu_cache_remap.
+ */
+void cpu_cache_write(CPU * cpu, uint16_t addr) {
+  CPUCache * cache = cpu->cache;
+  cache->writes++;
+  if (addr <= MEMORY_RAM_END) {
+    int index = addr % MEMORY_RAM_SIZE;
+    cpu_cache_invalidate(cache, index, 0);
+    // Instructions wrap around the end of RAM
+    for (int i = index - 2; i < 0; ++i) {
+      cache->entries[MEMORY_RAM_SIZE + i].generation = 0;
+    }
+  } else if (addr >= CPU_CACHE_SRAM && addr < 0x8000) {
+    cpu_cache_invalidate(cache, MEMORY_RAM_SIZE + (addr - CPU_CACHE_SRAM), MEMORY_RAM_SIZE);
+  }
+}
+
+// The memory behind first-last has been switched, drop the windows over it
+void cpu_cache_remap(CPU * cpu, uint16_t first, uint16_t last) {
+  if (last < CPU_CACHE_SRAM) {
+    return;
+  }
+  if (first < CPU_CACHE_SRAM) {
+    first = CPU_CACHE_SRAM;
+  }
+
+  int first_window = 1 + (first - CPU_CACHE_SRAM) / CPU_CACHE_WINDOW_SIZE;
+  int last_window = 1 + (last - CPU_CACHE_SRAM) / CPU_CACHE_WINDOW_SIZE;
+  for (int window = first_window; window <= last_window; ++window) {
+    cpu_cache_bump(cpu->cache, window);
+  }
+
+  // Instructions at the end of the window before may read operands from it
+  if (first_window > 1) {
+    int start = MEMORY_RAM_SIZE + (first_window - 1) * CPU_CACHE_WINDOW_SIZE;
+    cpu->cache->entries[start - 1].generation = 0;
+    cpu->cache->entries[start - 2].generation = 0;
+  }
+
+  // Blocks are only compiled from PRG ROM
+  if (last >= 0x8000 && cpu->jit) {
+    jit_invalidate(cpu->jit, first, last);
+  }
+}
+
+void cpu_cache_flush(CPU * cpu) {
+  CPUCache * cache = cpu->cache;
+  memset(cache, 0, sizeof(CPUCache));
+  for (int window = 0; window < CPU_CACHE_WINDOWS; ++window) {
+    cache->generation[window] = 1;
+  }
+
+  cpu_idle_flush(cpu);
+
+  if (cpu->jit) {
+    jit_flush(cpu->jit);
+  }
+}
+
+static void cpu_cached_instr(CPU * cpu) {
+  CPUCacheEntry * entry = cpu_cache_lookup(cpu, cpu->pc);
+  if (entry == NULL) {
+    cpu_fused_instr(cpu);
+    return;
+  }
+
+  cpu->pc += entry->length;
+  opcode_decoded[entry->opcode](cpu, entry->operand);
+  cpu->clock += entry->cycles;
+}
+
+static void cpu_cached_run(CPU * cpu) {
+  while (cpu->clock < cpu->deadline) {
+    cpu_cached_instr(cpu);
+  }
+}
+
+/*
+ * Idle loops
+ *
+ * Games often spin on a flag in RAM until the NMI handler changes it.
+ * A loop in PRG ROM that only reads memory, and that gets back to its
+ * branch with the same registers and no memory written in between, will
+ * keep repeating exactly until something outside the CPU steps in. So
+ * whole iterations can be skipped up to the deadline, which is where the
+ * next event happens.
+ *
+ * Most games wait for vertical blank by polling PPUSTATUS instead. The
+ * flag is only set at the PPU's vblank event, which the deadline never
+ * passes, and reading it while clear does nothing the next read won't
+ * do again. So a loop that only reads $2002 and branches on bit 7 is
+ * skipped the same way.
+ *
+ * Loops that can't be judged this way can be forced either way for a
+ * game, see cpu_idle_override.
+ */
+#define CPU_IDLE_LOOPS 64
+#define CPU_IDLE_OVERRIDES 16
+#define CPU_IDLE_BODY 32 // longest loop body in bytes
+
+typedef struct {
+  uint16_t head;       // branch target
+  uint16_t end;        // address following the branch
+  uint16_t generation; // of the cache window the verdict was made in
+  bool idle;
+  int period;          // most cycles one iteration can take
+
+  // State at the previous iteration
+  bool seen;
+  int clock;
+  unsigned writes;
+  uint8_t a, x, y, sp, p;
+} CPUIdleLoop;
+
+struct CPUIdle {
+  bool enabled; // off while benchmarking, so only real work is timed
+  CPUIdleLoop loops[CPU_IDLE_LOOPS];
+
+  int override_count;
+  struct {
+    uint16_t head;
+    CPUIdleOverride override;
+  } overrides[CPU_IDLE_OVERRIDES];
+};
+
+static CPUIdle * cpu_idle_create(void) {
+  CPUIdle * idle = calloc(1, sizeof(CPUIdle));
+  if (idle == NULL) {
+    fprintf(stderr, "Failed to allocate idle loop table\n");
+    exit(1);
+  }
+
+  idle->enabled = true;
+  return idle;
+}
+
+static CPUIdleOverride cpu_idle_find_override(CPU * cpu, uint16_t head) {
+  CPUIdle * idle = cpu->idle;
+  for (int i = 0; i < idle->override_count; ++i) {
+    if (idle->overrides[i].head == head) {
+      return idle->overrides[i].override;
+    }
+  }
+
+  return CPU_IDLE_DETECT;
+}
+
+static bool cpu_idle_io(uint16_t addr) {
+  return addr >= 0x2000 && addr < CPU_CACHE_SRAM;
+}
+
+// `LDA $2002 / BPL` and the like: the read is the whole loop but for the branch
+static bool cpu_idle_vblank_wait(CPU * cpu, uint16_t head, uint16_t end) {
+  CPUCacheEntry * read = cpu_cache_lookup(cpu, head);
+  if (opcode_addressing_mode[read->opcode] != ADDR_ABSOLUTE || (read->operand & 0xE007) != 0x2002) {
+    return false;
+  }
+
+  switch (opcode_instruction[read->opcode]) {
+  case INSTR_LDA: case INSTR_LDX: case INSTR_LDY: case INSTR_BIT:
+    break;
+  default:
+    return false;
+  }
+
+  uint16_t pc = head + read->length;
+  CPUCacheEntry * branch = cpu_cache_lookup(cpu, pc);
+  return opcode_instruction[branch->opcode] == INSTR_BPL && pc + branch->length == end;
+}
+
+/**
+ * Check that the loop body only reads memory, or is a vblank wait, and
+ * runs each instruction at most once per iteration. With io set, reads of
+ * the I/O registers are allowed too. Returns the most cycles an iteration
+ * can take, or 0 if the loop can't be skipped.
+ */
+static int cpu_idle_analyze(CPU * cpu, uint16_t head, uint16_t end, bool io) {
+  int period = 0;
+
+  for (uint16_t pc = head; pc < end;) {
+    CPUCacheEntry * entry = cpu_cache_lookup(cpu, pc);
+    uint8_t opcode = entry->opcode;
+    AdressingMode mode = opcode_addressing_mode[opcode];
+    uint16_t operand = entry->operand;
+
+    switch (opcode_instruction[opcode]) {
+    case INSTR_LDA: case INSTR_LDX: case INSTR_LDY: case INSTR_BIT:
+    case INSTR_CMP: case INSTR_CPX: case INSTR_CPY: case INSTR_AND:
+    case INSTR_ORA: case INSTR_EOR: case INSTR_ADC: case INSTR_SBC:
+    case INSTR_TAX: case INSTR_TAY: case INSTR_TXA: case INSTR_TYA:
+    case INSTR_INX: case INSTR_INY: case INSTR_DEX: case INSTR_DEY:
+    case INSTR_CLC: case INSTR_SEC: case INSTR_CLV: case INSTR_NOP:
+      break;
+    case INSTR_ASL: case INSTR_LSR: case INSTR_ROL: case INSTR_ROR:
+      if (mode != ADDR_ACCUMULATOR) {
+        return 0;
+      }
+      break;
+    case INSTR_BCC: case INSTR_BCS: case INSTR_BEQ: case INSTR_BMI:
+    case INSTR_BNE: case INSTR_BPL: case INSTR_BVC: case INSTR_BVS:
+      // Only the loop itself may branch backwards
+      if (operand < pc && pc + entry->length != end) {
+        return 0;
+      }
+      break;
+    default:
+      return 0;
+    }
+
+    switch (mode) {
+    case ADDR_ABSOLUTE:
+      if (cpu_idle_io(operand) && !io && !cpu_idle_vblank_wait(cpu, head, end)) {
+        return 0;
+      }
+      break;
+    case ADDR_ABSOLUTE_X:
+    case ADDR_ABSOLUTE_Y:
+      if ((cpu_idle_io(operand) || cpu_idle_io(operand + 0xFF)) && !io) {
+        return 0;
+      }
+      break;
+    case ADDR_INDIRECT_INDEXED:
+    case ADDR_INDEXED_INDIRECT:
+      if (!io) {
+        return 0;
+      }
+      break;
+    default:
+      break;
+    }
+
+    // Taken branches and page crossings cost at most two more cycles
+    period += opcode_cycles[opcode] + 2;
+    pc += entry->length;
+  }
+
+  return period;
+}
+
+// Called whenever a branch is taken backwards, with the CPU at the loop head
+static void cpu_idle_loop(CPU * cpu, uint16_t head, uint16_t end) {
+  int window, index;
+  if (!cpu->idle->enabled || head < 0x8000 || end - head > CPU_IDLE_BODY || !cpu_cache_index(head, &window, &index)) {
+    return;
+  }
+
+  CPUCache * cache = cpu->cache;
+  CPUIdleLoop * loop = &cpu->idle->loops[head % CPU_IDLE_LOOPS];
+  if (loop->head != head || loop->end != end || loop->generation != cache->generation[window]) {
+    CPUIdleOverride override = cpu_idle_find_override(cpu, head);
+
+    loop->head = head;
+    loop->end = end;
+    loop->generation = cache->generation[window];
+    loop->period = 0;
+    if (override != CPU_IDLE_NEVER) {
+      loop->period = cpu_idle_analyze(cpu, head, end, override == CPU_IDLE_ALWAYS);
+    }
+    loop->idle = loop->period != 0;
+    loop->seen = false;
+  }
+
+  if (!loop->idle) {
+    return;
+  }
+
+  uint8_t p = cpu_status_read(cpu);
+  if (loop->seen && loop->writes == cache->writes && cpu->clock - loop->clock <= loop->period &&
+      loop->a == cpu->a && loop->x == cpu->x && loop->y == cpu->y &&
+      loop->sp == cpu->sp && loop->p == p) {
+    // The branch still has its own cycles to add, the last iteration
+    // before the deadline is left to run normally
+    int period = cpu->clock - loop->clock;
+    int skip = (cpu->deadline - cpu->clock - 3) / period;
+    if (skip > 0) {
+      cpu->clock += skip * period;
+    }
+  }
+
+  loop->seen = true;
+  loop->clock = cpu->clock;
+  loop->writes = cache->writes;
+  loop->a = cpu->a;
+  loop->x = cpu->x;
+  loop->y = cpu->y;
+  loop->sp = cpu->sp;
+  loop->p = p;
+}
+
+void cpu_idle_override(CPU * cpu, uint16_t addr, CPUIdleOverride override) {
+  CPUIdle * idle = cpu->idle;
+  if (idle->override_count == CPU_IDLE_OVERRIDES) {
+    fprintf(stderr, "Too many idle loop overrides, ignoring $%04X\n", addr);
+    return;
+  }
+
+  idle->overrides[idle->override_count].head = addr;
+  idle->overrides[idle->override_count].override = override;
+  idle->override_count++;
+  cpu_idle_flush(cpu);
+}
+
+void cpu_idle_clear_overrides(CPU * cpu) {
+  cpu->idle->override_count = 0;
+  cpu_idle_flush(cpu);
+}
+
+// Forget all verdicts, the code they were made for may have changed
+static void cpu_idle_flush(CPU * cpu) {
+  memset(cpu->idle->loops, 0, sizeof(cpu->idle->loops));
+}
+
+static void cpu_idle_rebase(CPU * cpu, int cycles) {
+  for (int i = 0; i < CPU_IDLE_LOOPS; ++i) {
+    cpu->idle->loops[i].clock -= cycles;
+  }
+}
+
+/*
+ * Recompiler frontend
+ *
+ * Tells the recompiler how each instruction in PRG ROM affects control
+ * flow, and which ones have to be left to the interpreter: accesses to
+ * the I/O registers need an exact clock, and writes to the cartridge may
+ * switch banks under the compiled code.
+ */
+static bool cpu_jit_writes(Instruction instruction) {
+  switch (instruction) {
+  case INSTR_STA: case INSTR_STX: case INSTR_STY:
+  case INSTR_INC: case INSTR_DEC:
+  case INSTR_ASL: case INSTR_LSR: case INSTR_ROL: case INSTR_ROR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool cpu_jit_io(uint16_t addr) {
+  return addr >= 0x2000 && addr < CPU_CACHE_SRAM;
+}
+
+static void cpu_jit_decode(CPU * cpu, uint16_t pc, JITInstr * instr) {
+  CPUCacheEntry * entry = cpu_cache_lookup(cpu, pc);
+  uint8_t opcode = entry->opcode;
+  Instruction instruction = opcode_instruction[opcode];
+  AdressingMode mode = opcode_addressing_mode[opcode];
+
+  instr->handler = opcode_decoded[opcode];
+  instr->operand = entry->operand;
+  instr->length = entry->length;
+  instr->cycles = entry->cycles;
+  instr->sync = false;
+
+  switch (instruction) {
+  case INSTR_BCC: case INSTR_BCS: case INSTR_BEQ: case INSTR_BMI:
+  case INSTR_BNE: case INSTR_BPL: case INSTR_BVC: case INSTR_BVS:
+    instr->kind = JIT_INSTR_BRANCH;
+    return;
+  case INSTR_JSR:
+    instr->kind = JIT_INSTR_JUMP;
+    return;
+  case INSTR_JMP:
+    instr->kind = mode == ADDR_ABSOLUTE ? JIT_INSTR_JUMP : JIT_INSTR_RETURN;
+    return;
+  case INSTR_BRK: case INSTR_RTI: case INSTR_RTS:
+    instr->kind = JIT_INSTR_RETURN;
+    return;
+
+  // Unofficial instructions drop into the debugger
+  case INSTR_AHX: case INSTR_ALR: case INSTR_ANC: case INSTR_ARR:
+  case INSTR_AXS: case INSTR_DCP: case INSTR_ISC: case INSTR_LAS:
+  case INSTR_LAX: case INSTR_RLA: case INSTR_RRA: case INSTR_SAX:
+  case INSTR_SHX: case INSTR_SHY: case INSTR_SLO: case INSTR_SRE:
+  case INSTR_STP: case INSTR_TAS: case INSTR_XAA:
+    instr->kind = JIT_INSTR_INTERPRET;
+    return;
+
+  default:
+    instr->kind = JIT_INSTR_PLAIN;
+    break;
+  }
+
+  uint16_t operand = entry->operand;
+  switch (mode) {
+  case ADDR_ABSOLUTE:
+    if (cpu_jit_io(operand) || (operand >= 0x8000 && cpu_jit_writes(instruction))) {
+      instr->kind = JIT_INSTR_INTERPRET;
+    }
+    break;
+  case ADDR_ABSOLUTE_X:
+  case ADDR_ABSOLUTE_Y:
+    if (operand + 0xFF >= 0x8000 && cpu_jit_writes(instruction)) {
+      instr->kind = JIT_INSTR_INTERPRET;
+    } else if (cpu_jit_io(operand) || cpu_jit_io(operand + 0xFF)) {
+      instr->sync = true;
+    }
+    break;
+  case ADDR_INDIRECT_INDEXED:
+  case ADDR_INDEXED_INDIRECT:
+    // The target is only known at run time, so stores may hit a mapper
+    if (cpu_jit_writes(instruction)) {
+      instr->kind = JIT_INSTR_INTERPRET;
+    } else {
+      instr->sync = true;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static JIT * cpu_jit(CPU * cpu) {
+  if (cpu->jit == NULL) {
+    cpu->jit = jit_create(cpu_jit_decode);
+  }
+
+  return cpu->jit;
+}
+
+// Compiled blocks where possible, the interpreter everywhere else
+static void cpu_jit_run(CPU * cpu) {
+  if (cpu_jit(cpu) == NULL) {
+    fprintf(stderr, "Recompiler unavailable, using cached dispatch\n");
+    cpu->dispatch = CPU_DISPATCH_CACHED;
+    cpu_cached_run(cpu);
+    return;
+  }
+
+  while (cpu->clock < cpu->deadline) {
+    if (!jit_run(cpu->jit, cpu)) {
+      cpu_next_instr(cpu);
+    }
+  }
+}
+
 /**
  * Debugging
  */
@@ -817,7 +1686,7 @@ static int debug_addr_absolute(CPU * cpu, char * buffer, Instruction instruction
 static int debug_addr_relative(CPU * cpu, char * buffer, Instruction instruction) {
   const char * name = instruction_name[instruction];
   uint8_t offset = cpu_memory_read(cpu, cpu->pc + 1);
-  uint16_t addr = cpu->pc + 2 + offset;
+  uint16_t addr = cpu->pc + 2 + (int8_t)offset;
 
   return sprintf(buffer, "%02X     %s $%04X", offset, name, addr);
 }
@@ -970,26 +1839,36 @@ void cpu_debug_reset(CPU * cpu, const char * buffer) {
   printf("Reset to initial state\n");
 }
 
-void cpu_debug_test(CPU * cpu, const char * buffer) {
-  char * ptr;
-  int tolerance = strtol(buffer, &ptr, 0);
-  if (ptr == buffer) {
-    tolerance = 1;
+static const char * cpu_dispatch_name[] = {
+  [CPU_DISPATCH_GENERIC] = "generic",
+  [CPU_DISPATCH_FUSED] = "fused",
+  [CPU_DISPATCH_CACHED] = "cached",
+  [CPU_DISPATCH_JIT] = "jit",
+};
+
+void cpu_debug_dispatch(CPU * cpu, const char * buffer) {
+  while (*buffer == ' ') {
+    buffer++;
   }
 
-  FILE * fp = fopen("test/sub-nestest.log", "r");
-  if (fp == NULL) {
-    fprintf(stderr, "Failed to load test: %s\n", strerror(errno));
+  for (size_t i = 0; i < ARRAY_LENGTH(cpu_dispatch_name); ++i) {
+    if (strncmp(buffer, cpu_dispatch_name[i], strlen(cpu_dispatch_name[i])) == 0) {
+      cpu->dispatch = i;
+      break;
+    }
   }
 
-  cpu_debug_reset(cpu, buffer);
+  printf("Dispatch: %s\n", cpu_dispatch_name[cpu->dispatch]);
+}
+
+// Compare the trace of the running CPU against the nestest log
+static void cpu_debug_test_log(CPU * cpu, FILE * fp, int tolerance) {
+  cpu_debug_reset(cpu, "");
 
   // Nestest must start at 0xC000 but the
   // reset vector is 0xC0004 for some reason
   cpu->pc = 0xC000;
 
-  printf("\n");
-
   int lineno = 1;
   char test[CPU_DEBUG_LENGTH + 1], debug[CPU_DEBUG_LENGTH];
   while (tolerance != 0 && fgets(test, ARRAY_LENGTH(test), fp) != NULL) {
@@ -1002,9 +1881,143 @@ void cpu_debug_test(CPU * cpu, const char * buffer) {
       }
     }
 
-    cpu_next_instr(cpu);
+    if (cpu->dispatch == CPU_DISPATCH_JIT) {
+      cpu_run(cpu, 1);
+    } else {
+      cpu_next_instr(cpu);
+    }
     lineno += 1;
   }
+}
+
+typedef struct {
+  int clock;
+  uint16_t pc;
+  uint8_t a, x, y, sp, p;
+} CPUDebugState;
+
+static CPUDebugState cpu_debug_state(CPU * cpu) {
+  return (CPUDebugState){cpu->clock, cpu->pc, cpu->a, cpu->x, cpu->y, cpu->sp, cpu_status_read(cpu)};
+}
+
+static bool cpu_debug_state_equal(const CPUDebugState * a, const CPUDebugState * b) {
+  return a->clock == b->clock && a->pc == b->pc && a->a == b->a && a->x == b->x &&
+         a->y == b->y && a->sp == b->sp && a->p == b->p;
+}
+
+/**
+ * Run the nestest code through whole recompiled blocks, chained into each
+ * other, and check the state wherever cpu_run stops against the cached
+ * dispatch, up to the first difference. Pages of code are dropped now and then along the way, so
+ * blocks get compiled again and the jumps into them undone.
+ */
+static void cpu_debug_test_blocks(CPU * cpu, JIT * jit, int count) {
+  CPUDebugState * expected = malloc((count + 1) * sizeof(CPUDebugState));
+  if (expected == NULL) {
+    fprintf(stderr, "Failed to allocate test states\n");
+    return;
+  }
+
+  cpu->dispatch = CPU_DISPATCH_CACHED;
+  cpu_debug_reset(cpu, "");
+  cpu->pc = 0xC000;
+  for (int i = 0; i < count; ++i) {
+    expected[i] = cpu_debug_state(cpu);
+    cpu_next_instr(cpu);
+  }
+  expected[count] = cpu_debug_state(cpu);
+
+  cpu->dispatch = CPU_DISPATCH_JIT;
+  cpu_debug_reset(cpu, "");
+  cpu->pc = 0xC000;
+  jit_eager(jit, true);
+
+  int i = 0;
+  int runs = 0;
+  int end = expected[count].clock;
+  while (cpu->clock < end) {
+    int slice = 1 + runs % 97;
+    cpu_run(cpu, end - cpu->clock < slice ? end - cpu->clock : slice);
+
+    if (++runs % 50 == 0) {
+      uint16_t first = 0xC000 + (runs / 50 % 64) * 0x100;
+      jit_invalidate(jit, first, first + 0xFF);
+    }
+
+    // The last block may run on past the end of the log
+    if (cpu->clock > end) {
+      break;
+    }
+
+    while (i < count && expected[i].clock < cpu->clock) {
+      i++;
+    }
+
+    CPUDebugState state = cpu_debug_state(cpu);
+    if (!cpu_debug_state_equal(&state, &expected[i])) {
+      printf("Test Failed (block run %i):\n"
+             "Expected: PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%i\n"
+             "Obtained: PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%i\n",
+             runs,
+             expected[i].pc, expected[i].a, expected[i].x, expected[i].y, expected[i].p, expected[i].sp, expected[i].clock,
+             state.pc, state.a, state.x, state.y, state.p, state.sp, state.clock);
+      break;
+    }
+  }
+
+  printf("Checked %i block runs\n", runs);
+  jit_eager(jit, false);
+  free(expected);
+}
+
+// Run the nestest log against every dispatch mode
+void cpu_debug_test(CPU * cpu, const char * buffer) {
+  char * ptr;
+  int tolerance = strtol(buffer, &ptr, 0);
+  if (ptr == buffer) {
+    tolerance = 1;
+  }
+
+  FILE * fp = fopen("test/sub-nestest.log", "r");
+  if (fp == NULL) {
+    fprintf(stderr, "Failed to load test: %s\n", strerror(errno));
+    return;
+  }
+
+  int count = 0;
+  char line[CPU_DEBUG_LENGTH + 1];
+  while (fgets(line, ARRAY_LENGTH(line), fp) != NULL) {
+    count++;
+  }
+
+  // The recompiler is checked in whole blocks too, which can't be traced,
+  // so idle loops are left to run for the states to match
+  CPUDispatch dispatch = cpu->dispatch;
+  cpu->idle->enabled = false;
+  for (size_t i = 0; i < ARRAY_LENGTH(cpu_dispatch_name); ++i) {
+    printf("\nDispatch: %s\n", cpu_dispatch_name[i]);
+    cpu->dispatch = i;
+    rewind(fp);
+
+    // Blocks of a single instruction, so every step can be traced
+    if (i == CPU_DISPATCH_JIT) {
+      JIT * jit = cpu_jit(cpu);
+      if (jit == NULL) {
+        printf("Recompiler unavailable\n");
+        continue;
+      }
+      jit_single_step(jit, true);
+      cpu_debug_test_log(cpu, fp, tolerance);
+      jit_single_step(jit, false);
+
+      printf("\nDispatch: jit blocks\n");
+      cpu_debug_test_blocks(cpu, jit, count);
+    } else {
+      cpu_debug_test_log(cpu, fp, tolerance);
+    }
+  }
+  cpu->idle->enabled = true;
+  cpu->dispatch = dispatch;
 
   fclose(fp);
 
@@ -1012,6 +2025,125 @@ void cpu_debug_test(CPU * cpu, const char * buffer) {
   cpu_debug_reset(cpu, buffer);
 }
 
+static double cpu_debug_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A negative instruction count leaves those columns out
+static void cpu_debug_bench_report(const char * name, long instrs, int cycles, double seconds) {
+  if (instrs < 0) {
+    printf("%-10s %10s instr %11i cycles %8.3fs %8s Minstr/s %8.2f MHz\n",
+           name, "-", cycles, seconds, "-", cycles / seconds / 1e6);
+    return;
+  }
+
+  printf("%-10s %10li instr %11i cycles %8.3fs %8.2f Minstr/s %8.2f MHz\n",
+         name, instrs, cycles, seconds, instrs / seconds / 1e6, cycles / seconds / 1e6);
+}
+
+// Measure instructions per second of each dispatch mode from reset
+void cpu_debug_bench(CPU * cpu, const char * buffer) {
+  char * ptr;
+  int cycles = strtol(buffer, &ptr, 0);
+  if (ptr == buffer) {
+    cycles = 100000000;
+  }
+
+  CPUDispatch dispatch = cpu->dispatch;
+  cpu->idle->enabled = false;
+
+  // Stepping one instruction at a time, as cpu_next_instr is called
+  for (size_t i = 0; i < ARRAY_LENGTH(cpu_dispatch_name); ++i) {
+    cpu_debug_reset(cpu, buffer);
+    cpu->dispatch = i;
+
+    long instrs = 0;
+    double start = cpu_debug_seconds();
+    while (cpu->clock < cycles) {
+      cpu_next_instr(cpu);
+      instrs++;
+    }
+
+    cpu_debug_bench_report(cpu_dispatch_name[i], instrs, cpu->clock, cpu_debug_seconds() - start);
+  }
+
+  // Threaded code runs to the deadline the way cpu_run does, counting
+  cpu_debug_reset(cpu, buffer);
+  cpu->dispatch = CPU_DISPATCH_FUSED;
+  double start = cpu_debug_seconds();
+  cpu->deadline = cycles;
+  cpu_poll_interrupts(cpu);
+  long instrs = cpu_threaded_run(cpu);
+  cpu_debug_bench_report("threaded", instrs, cpu->clock, cpu_debug_seconds() - start);
+
+  // The other batches don't count instructions, so only cycles are compared
+  static const struct {
+    const char * name;
+    CPUDispatch dispatch;
+  } batches[] = {
+    {"cached run", CPU_DISPATCH_CACHED},
+    {"jit run", CPU_DISPATCH_JIT},
+  };
+
+  for (size_t i = 0; i < ARRAY_LENGTH(batches); ++i) {
+    cpu_debug_reset(cpu, buffer);
+    cpu->dispatch = batches[i].dispatch;
+
+    start = cpu_debug_seconds();
+    cpu_run(cpu, cycles);
+    cpu_debug_bench_report(batches[i].name, -1, cpu->clock, cpu_debug_seconds() - start);
+  }
+
+  cpu->idle->enabled = true;
+  cpu->dispatch = dispatch;
+  cpu_debug_reset(cpu, buffer);
+}
+
+static const char * cpu_ppu_mode_name[] = {
+  [PPU_MODE_SCANLINE] = "scanline",
+  [PPU_MODE_DOT] = "dot",
+};
+
+void cpu_debug_ppu(CPU * cpu, const char * buffer) {
+  PPU * ppu = &cpu_nes(cpu)->ppu;
+  while (*buffer == ' ') {
+    buffer++;
+  }
+
+  for (size_t i = 0; i < ARRAY_LENGTH(cpu_ppu_mode_name); ++i) {
+    if (strncmp(buffer, cpu_ppu_mode_name[i], strlen(cpu_ppu_mode_name[i])) == 0) {
+      ppu->mode = i;
+      break;
+    }
+  }
+
+  printf("PPU: %s, composing with %s\n", cpu_ppu_mode_name[ppu->mode], compose_name());
+}
+
+// Measure each way of syncing the rest of the NES with the CPU
+void cpu_debug_sync(CPU * cpu, const char * buffer) {
+  char * ptr;
+  int cycles = strtol(buffer, &ptr, 0);
+  if (ptr == buffer) {
+    cycles = 100000000;
+  }
+
+  nes_bench(cpu_nes(cpu), cycles);
+}
+
+// Run frames through nes_run, by default past the 2^31 cycles an int holds
+void cpu_debug_soak(CPU * cpu, const char * buffer) {
+  char * ptr;
+  int frames = strtol(buffer, &ptr, 0);
+  if (ptr == buffer) {
+    frames = 80000;
+  }
+
+  nes_soak(cpu_nes(cpu), frames);
+}
+
 void cpu_debug_quit(CPU * cpu, const char * buffer) {
   (void)cpu;
   (void)buffer;
@@ -1028,6 +2160,11 @@ const struct {
   {"reset", cpu_debug_reset},
   {"rs", cpu_debug_reset},
   {"test", cpu_debug_test},
+  {"dispatch", cpu_debug_dispatch},
+  {"bench", cpu_debug_bench},
+  {"sync", cpu_debug_sync},
+  {"soak", cpu_debug_soak},
+  {"ppu", cpu_debug_ppu},
   {"quit", cpu_debug_quit},
   {"exit", cpu_debug_quit}
 };
@@ -2,6 +2,7 @@
 #define CPU_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * References:
@@ -10,28 +11,75 @@
  * Opcodes: http://www.6502.org/tutorials/6502opcodes.html
  */
 
+typedef enum {
+  CPU_DISPATCH_GENERIC, // Decode through the opcode tables (reference)
+  CPU_DISPATCH_FUSED,   // Generated per-opcode handlers
+  CPU_DISPATCH_CACHED,  // Pre-decoded instructions, see cpu_cached_instr
+  CPU_DISPATCH_JIT,     // Recompiled basic blocks in cpu_run, see jit.h
+} CPUDispatch;
+
+typedef enum {
+  CPU_IDLE_DETECT, // skip the loop if it can be proven idle
+  CPU_IDLE_NEVER,  // never skip the loop
+  CPU_IDLE_ALWAYS, // skip the loop even though it reads I/O registers
+} CPUIdleOverride;
+
+// Devices that can hold the IRQ line, any of them asserts it
+typedef enum {
+  CPU_IRQ_FRAME  = 1 << 0, // APU frame counter
+  CPU_IRQ_DMC    = 1 << 1, // APU DMC sample end
+  CPU_IRQ_MAPPER = 1 << 2, // cartridge
+} CPUIRQ;
+
+typedef struct CPUCache CPUCache;
+typedef struct CPUIdle CPUIdle;
+
 typedef struct CPU CPU;
 struct CPU {
   int clock;
+  int deadline; // cpu_run returns once clock reaches this
+  CPUDispatch dispatch;
+  CPUCache * cache;
+  CPUIdle * idle;
+  struct JIT * jit; // created on first use
+  uint8_t irq;      // CPUIRQ sources holding the IRQ line
+  bool nmi;         // An edge on the NMI line is waiting to be taken
 
   uint16_t pc;
   uint8_t sp;
   uint8_t a, x, y;
 
+  // Z, N and V are kept as the values they were derived from, and only
+  // worked out when read. See cpu_status_read.
+  uint8_t c;        // carry, 0 or 1
+  uint8_t z_result; // zero if the zero flag is set
+  uint8_t n_result; // bit 7 is the negative flag
+  uint8_t v_result; // bit 7 is the overflow flag
+
   struct {
-    uint8_t c : 1; // carry
-    uint8_t z : 1; // zero
     uint8_t i : 1; // interrupt disable
     uint8_t d : 1; // bcd enable (ignored)
-    uint8_t v : 1; // overflow
-    uint8_t n : 1; // negative
   };
 };
 
 void cpu_init(CPU * cpu);
+void cpu_deinit(CPU * cpu);
 void cpu_reset(CPU * cpu);
 
 void cpu_next_instr(CPU * cpu);
+int cpu_run(CPU * cpu, int cycles);
+void cpu_yield(CPU * cpu);
+void cpu_rebase(CPU * cpu, int cycles);
+void cpu_irq(CPU * cpu, CPUIRQ source, bool active);
+void cpu_nmi(CPU * cpu);
+
+void cpu_cache_write(CPU * cpu, uint16_t addr);
+void cpu_cache_remap(CPU * cpu, uint16_t first, uint16_t last);
+void cpu_cache_flush(CPU * cpu);
+
+void cpu_idle_override(CPU * cpu, uint16_t addr, CPUIdleOverride override);
+void cpu_idle_clear_overrides(CPU * cpu);
+
 void cpu_debug(CPU * cpu);
 
 #endif
@@ -50,6 +50,8 @@ const char * instruction_name[] = {
   "TXS" , "TYA" , "XAA"
 };
 
+#ifndef OPCODE_TABLES_ONLY
+
 typedef struct Address {
   uint16_t val;
   bool null : 1;
@@ -161,4 +163,6 @@ const Action instruction_action[] = {
   cpu_txs , cpu_tya , cpu_xaa
 };
 
+#endif // OPCODE_TABLES_ONLY
+
 #endif
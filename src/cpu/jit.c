@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * References:
+ * Instruction encoding: Intel 64 and IA-32 Architectures Software Developer's Manual, Vol. 2
+ * Perf map: https://github.com/torvalds/linux/blob/master/tools/perf/Documentation/jit-interface.txt
+ *
+ * Generated code keeps the CPU in rbx and the JIT in r12, both callee saved,
+ * so the opcode handlers can be called without spilling anything. A block
+ * exits by returning either NULL or the address of a jump to patch once
+ * the block it leads to has been compiled.
+ *
+ * The code buffer is never writable and executable at once. It is switched
+ * to writable for compiling and patching, and back before running a block.
+ *
+ * Every chained jump is kept as a link from its block to the address it
+ * leads to. When banks are switched, only the blocks over the switched
+ * range are dropped, and the jumps into them are pointed back at their
+ * exits. Their code stays in the buffer until it fills up.
+ */
+
+#define JIT_CODE_SIZE (4 << 20)
+#define JIT_BLOCK_SIZE 4096   // upper bound on the code size of one block
+#define JIT_BLOCK_LENGTH 64   // instructions
+#define JIT_HOT 16            // executions before a block is compiled
+#define JIT_LINKS (1 << 16)   // chained jumps
+
+#define JIT_PRG_ROM 0x8000
+#define JIT_PRG_ROM_SIZE 0x8000
+
+// Marks addresses that start with an instruction the interpreter must run
+#define JIT_INTERPRET ((uint8_t *)1)
+
+typedef uint8_t * (*JITEnter)(CPU * cpu, JIT * jit, uint8_t * code);
+
+typedef struct {
+  uint8_t * site; // the jmp emitted by emit_chain
+  uint16_t from;  // start of the block it is in
+  uint16_t to;    // start of the block it leads to
+} JITLink;
+
+struct JIT {
+  JITDecode decode;
+
+  uint8_t * code;
+  uint8_t * pos;
+  uint8_t * exit;
+  uint8_t * exit_null;
+  JITEnter enter;
+
+  uint8_t * blocks[JIT_PRG_ROM_SIZE];
+  uint16_t ends[JIT_PRG_ROM_SIZE]; // last byte of the 6502 code of each block
+  uint8_t heat[JIT_PRG_ROM_SIZE];
+
+  JITLink links[JIT_LINKS];
+  int link_count;
+
+  bool running;
+  bool writable;
+  uint8_t stale; // read by generated code, set when invalidated from a handler
+  uint16_t stale_first, stale_last; // what to drop once the block exits
+  bool single_step;
+  bool eager; // compile blocks the first time they run
+
+  FILE * perf_map;
+};
+
+/*
+ * Emitter
+ */
+static void emit8(JIT * jit, uint8_t val) {
+  *jit->pos++ = val;
+}
+
+static void emit16(JIT * jit, uint16_t val) {
+  memcpy(jit->pos, &val, sizeof(val));
+  jit->pos += sizeof(val);
+}
+
+static void emit32(JIT * jit, uint32_t val) {
+  memcpy(jit->pos, &val, sizeof(val));
+  jit->pos += sizeof(val);
+}
+
+static void emit64(JIT * jit, uint64_t val) {
+  memcpy(jit->pos, &val, sizeof(val));
+  jit->pos += sizeof(val);
+}
+
+static void jit_patch_rel32(uint8_t * pos, uint8_t * target) {
+  int32_t rel = target - (pos + 4);
+  memcpy(pos, &rel, sizeof(rel));
+}
+
+static void emit_rel32(JIT * jit, uint8_t * target) {
+  jit_patch_rel32(jit->pos, target);
+  jit->pos += 4;
+}
+
+// add dword [rbx + clock], cycles
+static void emit_add_clock(JIT * jit, int cycles) {
+  if (cycles != 0) {
+    emit8(jit, 0x81); emit8(jit, 0x83); emit32(jit, offsetof(CPU, clock));
+    emit32(jit, cycles);
+  }
+}
+
+// mov word [rbx + pc], pc
+static void emit_set_pc(JIT * jit, uint16_t pc) {
+  emit8(jit, 0x66); emit8(jit, 0xC7); emit8(jit, 0x83); emit32(jit, offsetof(CPU, pc));
+  emit16(jit, pc);
+}
+
+// handler(cpu, operand)
+static void emit_call(JIT * jit, JITHandler handler, uint16_t operand) {
+  emit8(jit, 0x48); emit8(jit, 0x89); emit8(jit, 0xDF);        // mov rdi, rbx
+  emit8(jit, 0xBE); emit32(jit, operand);                      // mov esi, operand
+  emit8(jit, 0x48); emit8(jit, 0xB8); emit64(jit, (uintptr_t)handler); // mov rax, handler
+  emit8(jit, 0xFF); emit8(jit, 0xD0);                          // call rax
+}
+
+// Leave the block, the dispatcher continues at cpu->pc
+static void emit_exit(JIT * jit) {
+  emit8(jit, 0xE9); emit_rel32(jit, jit->exit_null);
+}
+
+// Compare cpu->pc against a target, returns the location of the jne to patch
+static uint8_t * emit_jump_if_pc_not(JIT * jit, uint16_t pc) {
+  emit8(jit, 0x0F); emit8(jit, 0xB7); emit8(jit, 0x83); emit32(jit, offsetof(CPU, pc)); // movzx eax, word [rbx + pc]
+  emit8(jit, 0x3D); emit32(jit, pc);                           // cmp eax, pc
+  emit8(jit, 0x0F); emit8(jit, 0x85);                          // jne
+  uint8_t * rel = jit->pos;
+  emit32(jit, 0);
+  return rel;
+}
+
+/**
+ * Continue at the block of a known address, unless the deadline has been
+ * reached or the code has gone stale. The jump starts out pointing at the
+ * exit right after it, which hands its own address to the dispatcher.
+ * Returns the location of the jump.
+ */
+static uint8_t * emit_chain(JIT * jit) {
+  emit8(jit, 0x8B); emit8(jit, 0x83); emit32(jit, offsetof(CPU, clock));    // mov eax, [rbx + clock]
+  emit8(jit, 0x3B); emit8(jit, 0x83); emit32(jit, offsetof(CPU, deadline)); // cmp eax, [rbx + deadline]
+  emit8(jit, 0x0F); emit8(jit, 0x8D); emit_rel32(jit, jit->exit_null);     // jge exit
+  emit8(jit, 0x41); emit8(jit, 0x80); emit8(jit, 0xBC); emit8(jit, 0x24);  // cmp byte [r12 + stale], 0
+  emit32(jit, offsetof(JIT, stale)); emit8(jit, 0x00);
+  emit8(jit, 0x0F); emit8(jit, 0x85); emit_rel32(jit, jit->exit_null);     // jne exit
+
+  uint8_t * site = jit->pos;
+  emit8(jit, 0xE9); emit32(jit, 0);                                        // jmp block (patched)
+  emit8(jit, 0x48); emit8(jit, 0x8D); emit8(jit, 0x05); emit32(jit, -12);  // lea rax, [rip - 12]
+  emit8(jit, 0xE9); emit_rel32(jit, jit->exit);
+  return site;
+}
+
+static void jit_prologue(JIT * jit) {
+  jit->enter = (JITEnter)jit->pos;
+  emit8(jit, 0x53);                                            // push rbx
+  emit8(jit, 0x41); emit8(jit, 0x54);                          // push r12
+  emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xEC); emit8(jit, 0x08); // sub rsp, 8
+  emit8(jit, 0x48); emit8(jit, 0x89); emit8(jit, 0xFB);        // mov rbx, rdi
+  emit8(jit, 0x49); emit8(jit, 0x89); emit8(jit, 0xF4);        // mov r12, rsi
+  emit8(jit, 0xFF); emit8(jit, 0xE2);                          // jmp rdx
+
+  jit->exit_null = jit->pos;
+  emit8(jit, 0x31); emit8(jit, 0xC0);                          // xor eax, eax
+  jit->exit = jit->pos;
+  emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xC4); emit8(jit, 0x08); // add rsp, 8
+  emit8(jit, 0x41); emit8(jit, 0x5C);                          // pop r12
+  emit8(jit, 0x5B);                                            // pop rbx
+  emit8(jit, 0xC3);                                            // ret
+}
+
+/*
+ * Blocks
+ */
+static void jit_writable(JIT * jit, bool writable) {
+  if (jit->writable == writable) {
+    return;
+  }
+
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+  if (mprotect(jit->code, JIT_CODE_SIZE, prot) != 0) {
+    perror("mprotect");
+    abort();
+  }
+  jit->writable = writable;
+}
+
+static void jit_reset(JIT * jit) {
+  jit_writable(jit, true);
+  jit->pos = jit->code;
+  jit_prologue(jit);
+
+  memset(jit->blocks, 0, sizeof(jit->blocks));
+  memset(jit->heat, 0, sizeof(jit->heat));
+  jit->link_count = 0;
+  jit->stale = false;
+}
+
+// Remember a chained jump, so it can be undone if its target is dropped
+static void jit_link(JIT * jit, uint8_t * site, uint16_t from, uint16_t to) {
+  if (to >= JIT_PRG_ROM) {
+    jit->links[jit->link_count++] = (JITLink){site, from, to};
+  }
+}
+
+static bool jit_overlaps(JIT * jit, uint16_t start, uint16_t first, uint16_t last) {
+  return jit->blocks[start - JIT_PRG_ROM] != NULL && start <= last &&
+         jit->ends[start - JIT_PRG_ROM] >= first;
+}
+
+/**
+ * Drop the blocks with any code in first-last. Jumps out of them go with
+ * them, jumps into them are sent back to their exits.
+ */
+static void jit_drop(JIT * jit, uint16_t first, uint16_t last) {
+  if (first == JIT_PRG_ROM && last == JIT_PRG_ROM + JIT_PRG_ROM_SIZE - 1) {
+    jit_reset(jit);
+    return;
+  }
+
+  jit_writable(jit, true);
+  int count = 0;
+  for (int i = 0; i < jit->link_count; ++i) {
+    JITLink link = jit->links[i];
+    if (jit_overlaps(jit, link.from, first, last)) {
+      continue;
+    }
+    if (jit_overlaps(jit, link.to, first, last)) {
+      jit_patch_rel32(link.site + 1, link.site + 5);
+    }
+    jit->links[count++] = link;
+  }
+  jit->link_count = count;
+
+  int start = first - JIT_BLOCK_LENGTH * 3;
+  if (start < JIT_PRG_ROM) {
+    start = JIT_PRG_ROM;
+  }
+  for (int pc = start; pc <= last; ++pc) {
+    if (jit_overlaps(jit, pc, first, last)) {
+      jit->blocks[pc - JIT_PRG_ROM] = NULL;
+    }
+  }
+
+  // The code there is new, and has to get hot again
+  memset(&jit->heat[first - JIT_PRG_ROM], 0, last - first + 1);
+}
+
+// Note where the 6502 code of a block ends, and hand the block out
+static uint8_t * jit_place(JIT * jit, uint16_t start, int bytes, uint8_t * block) {
+  int end = start + bytes - 1;
+  jit->ends[start - JIT_PRG_ROM] = end > 0xFFFF ? 0xFFFF : end;
+  return jit->blocks[start - JIT_PRG_ROM] = block;
+}
+
+static uint8_t * jit_compile(JIT * jit, CPU * cpu, uint16_t start) {
+  JITInstr instr;
+  jit->decode(cpu, start, &instr);
+  if (instr.kind == JIT_INSTR_INTERPRET) {
+    return jit_place(jit, start, instr.length, JIT_INTERPRET);
+  }
+
+  jit_writable(jit, true);
+  uint8_t * block = jit->pos;
+  int length = jit->single_step ? 1 : JIT_BLOCK_LENGTH;
+  int cycles = 0;
+  int bytes = 0;
+  uint16_t pc = start;
+
+  // Straight-line code, clock updates are deferred to the end of the block
+  while (instr.kind == JIT_INSTR_PLAIN) {
+    if (instr.sync) {
+      emit_add_clock(jit, cycles);
+      cycles = 0;
+    }
+
+    emit_call(jit, instr.handler, instr.operand);
+    cycles += instr.cycles;
+    bytes += instr.length;
+    pc += instr.length;
+
+    if (--length == 0 || pc < JIT_PRG_ROM) {
+      emit_set_pc(jit, pc);
+      emit_add_clock(jit, cycles);
+      jit_link(jit, emit_chain(jit), start, pc);
+      goto done;
+    }
+
+    jit->decode(cpu, pc, &instr);
+  }
+
+  // The block ends with control flow, or where the interpreter takes over.
+  // Handlers see the clock as the interpreter would, without their own cost.
+  uint16_t next = pc + instr.length;
+  bytes += instr.length;
+  uint8_t * rel;
+  switch (instr.kind) {
+  case JIT_INSTR_INTERPRET:
+    emit_set_pc(jit, pc);
+    emit_add_clock(jit, cycles);
+    emit_exit(jit);
+    break;
+  case JIT_INSTR_BRANCH:
+    emit_set_pc(jit, next);
+    emit_add_clock(jit, cycles);
+    emit_call(jit, instr.handler, instr.operand);
+    emit_add_clock(jit, instr.cycles);
+    rel = emit_jump_if_pc_not(jit, instr.operand);
+    jit_link(jit, emit_chain(jit), start, instr.operand);
+    jit_patch_rel32(rel, jit->pos);
+    jit_link(jit, emit_chain(jit), start, next);
+    break;
+  case JIT_INSTR_JUMP:
+    emit_set_pc(jit, next);
+    emit_add_clock(jit, cycles);
+    emit_call(jit, instr.handler, instr.operand);
+    emit_add_clock(jit, instr.cycles);
+    rel = emit_jump_if_pc_not(jit, instr.operand);
+    jit_link(jit, emit_chain(jit), start, instr.operand);
+    jit_patch_rel32(rel, jit->exit_null);
+    break;
+  case JIT_INSTR_RETURN:
+  case JIT_INSTR_PLAIN:
+    emit_set_pc(jit, next);
+    emit_add_clock(jit, cycles);
+    emit_call(jit, instr.handler, instr.operand);
+    emit_add_clock(jit, instr.cycles);
+    emit_exit(jit);
+    break;
+  }
+
+done:
+  if (jit->perf_map) {
+    fprintf(jit->perf_map, "%" PRIxPTR " %tx nes_jit_%04X\n",
+            (uintptr_t)block, jit->pos - block, start);
+    fflush(jit->perf_map);
+  }
+
+  return jit_place(jit, start, bytes, block);
+}
+
+// Find or compile the block at an address, NULL if it should be interpreted
+static uint8_t * jit_block(JIT * jit, CPU * cpu, uint16_t pc, bool hot) {
+  if (pc < JIT_PRG_ROM) {
+    return NULL;
+  }
+
+  uint8_t * block = jit->blocks[pc - JIT_PRG_ROM];
+  if (block == NULL) {
+    if (!hot && !jit->single_step && !jit->eager && ++jit->heat[pc - JIT_PRG_ROM] < JIT_HOT) {
+      return NULL;
+    }
+    block = jit_compile(jit, cpu, pc);
+  }
+
+  return block == JIT_INTERPRET ? NULL : block;
+}
+
+/*
+ * Interface
+ */
+JIT * jit_create(JITDecode decode) {
+  JIT * jit = malloc(sizeof(JIT));
+  if (jit == NULL) {
+    return NULL;
+  }
+
+  jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jit->code == MAP_FAILED) {
+    free(jit);
+    return NULL;
+  }
+
+  jit->decode = decode;
+  jit->running = false;
+  jit->writable = true;
+  jit->single_step = false;
+  jit->eager = false;
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+  jit->perf_map = fopen(path, "w");
+
+  jit_reset(jit);
+  return jit;
+}
+
+void jit_destroy(JIT * jit) {
+  if (jit->perf_map) {
+    fclose(jit->perf_map);
+  }
+  munmap(jit->code, JIT_CODE_SIZE);
+  free(jit);
+}
+
+/**
+ * Run compiled blocks from cpu->pc until the deadline, or until reaching
+ * code that hasn't been compiled yet. Returns false if nothing was run,
+ * in which case the caller should interpret the next instruction.
+ */
+bool jit_run(JIT * jit, CPU * cpu) {
+  bool ran = false;
+  uint8_t * site = NULL;
+
+  while (cpu->clock < cpu->deadline) {
+    if (jit->pos + JIT_BLOCK_SIZE > jit->code + JIT_CODE_SIZE || jit->link_count + 2 > JIT_LINKS) {
+      jit_reset(jit);
+      site = NULL;
+    }
+
+    uint8_t * block = jit_block(jit, cpu, cpu->pc, site != NULL);
+    if (block == NULL) {
+      break;
+    }
+
+    if (site) {
+      jit_writable(jit, true);
+      jit_patch_rel32(site + 1, block);
+    }
+
+    jit_writable(jit, false);
+    jit->running = true;
+    site = jit->enter(cpu, jit, block);
+    jit->running = false;
+    ran = true;
+
+    if (jit->stale) {
+      jit->stale = false;
+      jit_drop(jit, jit->stale_first, jit->stale_last);
+      site = NULL;
+    }
+  }
+
+  return ran;
+}
+
+/**
+ * Drop the compiled code for first-last, whose memory has changed. When
+ * called from a handler inside a block the code is only marked stale,
+ * which stops the block from chaining further, and dropped once it exits.
+ */
+void jit_invalidate(JIT * jit, uint16_t first, uint16_t last) {
+  if (first < JIT_PRG_ROM) {
+    first = JIT_PRG_ROM;
+  }
+  if (last < first) {
+    return;
+  }
+
+  if (!jit->running) {
+    jit_drop(jit, first, last);
+  } else if (!jit->stale) {
+    jit->stale = true;
+    jit->stale_first = first;
+    jit->stale_last = last;
+  } else {
+    if (first < jit->stale_first) jit->stale_first = first;
+    if (last > jit->stale_last) jit->stale_last = last;
+  }
+}
+
+// Drop all compiled code
+void jit_flush(JIT * jit) {
+  jit_invalidate(jit, JIT_PRG_ROM, JIT_PRG_ROM + JIT_PRG_ROM_SIZE - 1);
+}
+
+// Compile every block immediately, one instruction long, for tracing
+void jit_single_step(JIT * jit, bool enable) {
+  jit->single_step = enable;
+  jit_flush(jit);
+}
+
+// Compile full blocks the first time they run, for testing code that isn't hot
+void jit_eager(JIT * jit, bool enable) {
+  jit->eager = enable;
+}
+
+#else
+
+JIT * jit_create(JITDecode decode) {
+  (void)decode;
+  return NULL;
+}
+
+void jit_destroy(JIT * jit) {
+  (void)jit;
+}
+
+bool jit_run(JIT * jit, CPU * cpu) {
+  (void)jit;
+  (void)cpu;
+  return false;
+}
+
+void jit_invalidate(JIT * jit, uint16_t first, uint16_t last) {
+  (void)jit;
+  (void)first;
+  (void)last;
+}
+
+void jit_flush(JIT * jit) {
+  (void)jit;
+}
+
+void jit_single_step(JIT * jit, bool enable) {
+  (void)jit;
+  (void)enable;
+}
+
+void jit_eager(JIT * jit, bool enable) {
+  (void)jit;
+  (void)enable;
+}
+
+#endif
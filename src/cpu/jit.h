@@ -0,0 +1,51 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+
+/**
+ * Dynamic recompiler for basic blocks in PRG ROM ($8000-$FFFF)
+ *
+ * Blocks are translated into x86-64 code that calls the decoded opcode
+ * handler of each instruction in turn, adds the cycle cost of the block
+ * when it exits, and jumps straight into the next block when the target
+ * is known at compile time. The CPU decides what each instruction does
+ * through the JITDecode callback, which keeps the opcode tables in cpu.c.
+ */
+
+typedef void (*JITHandler)(CPU * cpu, uint16_t operand);
+
+typedef enum {
+  JIT_INSTR_PLAIN,     // continues with the next instruction
+  JIT_INSTR_BRANCH,    // continues with the next instruction or the operand
+  JIT_INSTR_JUMP,      // continues at the operand
+  JIT_INSTR_RETURN,    // continues at an address only known at runtime
+  JIT_INSTR_INTERPRET, // must be run by the interpreter, ends the block
+} JITInstrKind;
+
+typedef struct {
+  JITInstrKind kind;
+  JITHandler handler;
+  uint16_t operand;
+  uint8_t length;
+  uint8_t cycles;
+  bool sync; // may touch I/O, the clock must be up to date
+} JITInstr;
+
+typedef void (*JITDecode)(CPU * cpu, uint16_t pc, JITInstr * instr);
+
+typedef struct JIT JIT;
+
+JIT * jit_create(JITDecode decode);
+void jit_destroy(JIT * jit);
+
+bool jit_run(JIT * jit, CPU * cpu);
+void jit_invalidate(JIT * jit, uint16_t first, uint16_t last);
+void jit_flush(JIT * jit);
+void jit_single_step(JIT * jit, bool enable);
+void jit_eager(JIT * jit, bool enable);
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <ctype.h>
+
+#define OPCODE_TABLES_ONLY
+#include "opcode.h"
+
+/**
+ * Generates one handler per opcode from the tables in opcode.h
+ *
+ * Each handler calls the addressing mode helper and the instruction
+ * directly, with the cycle cost baked in as a constant, so dispatching
+ * an instruction is a single indirect call through opcode_handler.
+ * OPCODE_LIST expands a macro for every opcode, for building threaded
+ * code out of the same handlers.
+ *
+ * The decoded variants take an operand that was fetched ahead of time,
+ * and leave the base cycle cost to the caller.
+ *
+ * Usage: opcode-gen > opcode-handlers.h
+ */
+
+static const struct {
+  const char * helper;
+  const char * syntax;
+  const char * fetch;
+  int length;
+  int page_cross;
+} addressing_modes[] = {
+  [ADDR_IMPLIED]          = {"implied",          "",      NULL,                            1, 0},
+  [ADDR_ACCUMULATOR]      = {"accumulator",      "A",     NULL,                            1, 0},
+  [ADDR_IMMEDIATE]        = {"immediate",        "#i",    "cpu->pc++",                     2, 0},
+  [ADDR_ZERO_PAGE]        = {"zero_page",        "d",     "cpu_memory_next(cpu)",          2, 0},
+  [ADDR_ABSOLUTE]         = {"absolute",         "a",     "cpu_memory_next16(cpu)",        3, 0},
+  [ADDR_RELATIVE]         = {"relative",         "*+d",   "cpu_memory_next_relative(cpu)", 2, 0},
+  [ADDR_ZERO_PAGE_X]      = {"zero_page_x",      "d,x",   "cpu_memory_next(cpu)",          2, 0},
+  [ADDR_ZERO_PAGE_Y]      = {"zero_page_y",      "d,y",   "cpu_memory_next(cpu)",          2, 0},
+  [ADDR_ABSOLUTE_X]       = {"absolute_x",       "a,x",   "cpu_memory_next16(cpu)",        3, 1},
+  [ADDR_ABSOLUTE_Y]       = {"absolute_y",       "a,y",   "cpu_memory_next16(cpu)",        3, 1},
+  [ADDR_INDIRECT]         = {"indirect",         "(a)",   "cpu_memory_next16(cpu)",        3, 0},
+  [ADDR_INDIRECT_INDEXED] = {"indirect_indexed", "(d),y", "cpu_memory_next(cpu)",          2, 1},
+  [ADDR_INDEXED_INDIRECT] = {"indexed_indirect", "(d,x)", "cpu_memory_next(cpu)",          2, 0},
+};
+
+static void print_action(Instruction instruction) {
+  const char * name = instruction_name[instruction];
+  printf("cpu_");
+  while (*name) {
+    putchar(tolower(*name++));
+  }
+}
+
+static void print_body(int opcode, const char * operand, int cycles) {
+  Instruction instruction = opcode_instruction[opcode];
+  AdressingMode mode = opcode_addressing_mode[opcode];
+  const char * helper = addressing_modes[mode].helper;
+  int page_cross = addressing_modes[mode].page_cross;
+
+  if (!addressing_modes[mode].fetch) {
+    printf("  Address addr = cpu_addr_%s(cpu);\n", helper);
+  } else if (page_cross) {
+    printf("  bool page_crossed;\n");
+    printf("  Address addr = cpu_addr_%s(cpu, %s, &page_crossed);\n", helper, operand);
+  } else {
+    printf("  Address addr = cpu_addr_%s(cpu, %s);\n", helper, operand);
+  }
+
+  printf("  ");
+  print_action(instruction);
+  printf("(cpu, addr);\n");
+
+  int page_cross_cycles = page_cross ? opcode_page_cross_cycles[opcode] : 0;
+  if (page_cross_cycles == 0 && cycles != 0) {
+    printf("  cpu->clock += %i;\n", cycles);
+  } else if (page_cross_cycles != 0) {
+    printf("  cpu->clock += ");
+    if (cycles != 0) {
+      printf("%i + ", cycles);
+    }
+    if (page_cross_cycles == 1) {
+      printf("page_crossed;\n");
+    } else {
+      printf("page_crossed * %i;\n", page_cross_cycles);
+    }
+  }
+}
+
+static void print_handler(int opcode) {
+  AdressingMode mode = opcode_addressing_mode[opcode];
+  const char * syntax = addressing_modes[mode].syntax;
+
+  printf("// $%02X: %s%s%s\n", opcode, instruction_name[opcode_instruction[opcode]],
+         *syntax ? " " : "", syntax);
+
+  printf("static void cpu_opcode_%02X(CPU * cpu) {\n", opcode);
+  print_body(opcode, addressing_modes[mode].fetch, opcode_cycles[opcode]);
+  printf("}\n\n");
+
+  printf("static void cpu_decoded_%02X(CPU * cpu, uint16_t operand) {\n", opcode);
+  if (!addressing_modes[mode].fetch) {
+    printf("  (void)operand;\n");
+  }
+  print_body(opcode, "operand", 0);
+  printf("}\n\n");
+}
+
+static void print_table(const char * type, const char * name, const char * format) {
+  printf("static const %s %s[256] = {\n", type, name);
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    printf(opcode % 8 == 0 ? "  " : " ");
+    printf(format, opcode);
+    printf(opcode == 255 ? "\n" : opcode % 8 == 7 ? ",\n" : ",");
+  }
+  printf("};\n\n");
+}
+
+int main(void) {
+  printf("/*\n");
+  printf(" * Generated by opcode-gen.c from the tables in opcode.h, do not edit.\n");
+  printf(" */\n\n");
+
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    print_handler(opcode);
+  }
+
+  printf("typedef void (*OpcodeHandler)(CPU * cpu);\n");
+  print_table("OpcodeHandler", "opcode_handler", "cpu_opcode_%02X");
+
+  printf("typedef void (*DecodedHandler)(CPU * cpu, uint16_t operand);\n");
+  print_table("DecodedHandler", "opcode_decoded", "cpu_decoded_%02X");
+
+  printf("static const uint8_t opcode_length[256] = {\n");
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    printf("%s%i%s", opcode % 16 == 0 ? "  " : "",
+           addressing_modes[opcode_addressing_mode[opcode]].length,
+           opcode == 255 ? "\n" : opcode % 16 == 15 ? ",\n" : ", ");
+  }
+  printf("};\n\n");
+
+  printf("#define OPCODE_LIST(X) \\\n");
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    printf("%sX(%02X)%s", opcode % 8 == 0 ? "  " : "",
+           opcode, opcode == 255 ? "\n" : opcode % 8 == 7 ? " \\\n" : " ");
+  }
+
+  return 0;
+}
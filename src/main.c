@@ -9,101 +9,60 @@
 #include "nes.h"
 #include "ui/ui.h"
 #include "cartridge/cartridge.h"
+#include "cartridge/catalog.h"
 #include "array.h"
 
-/**
- * Find ROM files recursively in a directory
+/*
+ * Prompt the user to select a ROM from the catalog
  */
-static GList * find_roms(GList * rom_list, const char * dir_name) {
-  GDir * dir = g_dir_open(dir_name, 0, NULL);
-  if (!dir) {
-    return rom_list;
+static GFile * select_rom(Catalog * catalog) {
+  int index = 0;
+  printf("%i) Quit\n", index++);
+  for (unsigned i = 0; i < catalog_size(catalog); ++i) {
+    printf("%i) Play \"%s\"\n", index++, catalog_get(catalog, i)->path);
   }
+  printf("Select action: ");
 
-  const char * file_name = g_dir_read_name(dir);
-  while (file_name != NULL) {
-    char * file_path = g_build_filename(dir_name, file_name, NULL);
-
-    if (g_file_test(file_path, G_FILE_TEST_IS_REGULAR))  {
-      rom_list = g_list_append(rom_list, file_path);
-    } else if (g_file_test(file_path, G_FILE_TEST_IS_DIR)) {
-      find_roms(rom_list, file_path);
-      g_free(file_path);
-    } else {
-      g_free(file_path);
-    }
+  char buffer[16];
+  if (fgets(buffer, ARRAY_LENGTH(buffer), stdin) == NULL) {
+    return NULL;
+  }
 
-    file_name = g_dir_read_name(dir);
+  char * ptr;
+  int input = strtoul(buffer, &ptr, 10);
+  if (ptr == buffer) {
+    printf("Error: %s\n", "Invalid");
+    return NULL;
   }
 
-  g_dir_close(dir);
-  return rom_list;
-}
+  if (input == 0) {
+    return NULL;
+  }
 
-/**
- * List a single ROM item for selection
- */
-static void list_rom(gpointer data, gpointer user_data) {
-  char * rom_name = data;
-  int * index = user_data;
-  printf("%i) Play \"%s\"\n", *index, rom_name);
-  *index += 1;
-}
+  const CatalogEntry * entry = catalog_get(catalog, input - 1);
+  if (!entry) {
+    printf("Error: %s\n", "Out of range");
+    return NULL;
+  }
 
-/*
- * Prompt the user to select a ROM from a list
- */
-static GFile * select_rom(GList * rom_list) {
-  const char * file_name;
-
-  do {
-    int index = 0;
-    printf("%i) Quit\n", index++);
-    g_list_foreach(rom_list, list_rom, &index);
-    printf("Select action: ");
-
-    char buffer[16];
-    if (fgets(buffer, ARRAY_LENGTH(buffer), stdin) == NULL) {
-      return NULL;
-    }
-
-    char * ptr;
-    int input = strtoul(buffer, &ptr, 10);
-    if (ptr == buffer) {
-      printf("Error: %s\n", "Invalid");
-      return NULL;
-    }
-
-    if (input == 0) {
-      return NULL;
-    }
-
-    file_name = g_list_nth_data(rom_list, input - 1);
-    if (!file_name) {
-      printf("Error: %s\n", "Out of range");
-      return NULL;
-    }
-
-    break;
-  } while (1);
-
-  return g_file_new_for_path(file_name);
+  return g_file_new_for_path(entry->path);
 }
 
 int main(void) {
   const char * dir = "roms/";
 
-  GList * rom_list = NULL;
-  rom_list = find_roms(rom_list, dir);
-  if (rom_list == NULL) {
+  char * cache_path = g_build_filename(g_get_user_cache_dir(), "nes-emu", "catalog", NULL);
+  Catalog * catalog = catalog_open(dir, cache_path);
+  g_free(cache_path);
+
+  if (catalog_size(catalog) == 0) {
     fprintf(stderr, "No ROMs found at '%s'\n", dir);
+    catalog_close(catalog);
     return 1;
   }
 
-  rom_list = g_list_sort(rom_list, (GCompareFunc)g_strcmp0);
-
-  GFile * rom_file = select_rom(rom_list);
-  g_list_free_full(rom_list, g_free);
+  GFile * rom_file = select_rom(catalog);
+  catalog_close(catalog);
   if (!rom_file) {
     return 1;
   }
@@ -125,6 +84,7 @@ int main(void) {
   ui_init(&ui);
   ui_run(&ui, cartridge);
   ui_deinit(&ui);
+  cartridge_destroy(cartridge);
 
   Pa_Terminate();
   glfwTerminate();
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <gmodule.h>
+
+#include "mapper.h"
+#include "array.h"
+
+/**
+ * Mappers are looked up in the built-in registry first. Anything else is
+ * loaded from ./mapper as a plugin, but only when NES_MAPPER_PLUGINS is
+ * set, since that may need a compiler at runtime.
+ */
+
+#define X(no) extern const MapperInterface mapper_interface_##no;
+MAPPER_BUILTINS(X)
+#undef X
+
+static const struct {
+  int mapper_no;
+  const MapperInterface * interface;
+} mapper_builtins[] = {
+#define X(no) {no, &mapper_interface_##no},
+  MAPPER_BUILTINS(X)
+#undef X
+};
+
+struct Mapper {
+  Mapper * raw;
+  GModule * module; // NULL for built-in mappers
+  Cartridge * cartridge;
+  bool builtin;
+
+  // ABI v2, NULL for v1 mappers
+  const MapperInterface * interface;
+  MapperBanks banks;
+
+  MapperChanged changed;
+  void * changed_data;
+
+  // ABI v1
+  Mapper * (*create)(Cartridge * cartridge);
+  void (*destroy)(Mapper * mapper);
+  void (*write)(Mapper * mapper, uint16_t addr, uint8_t val);
+  uint8_t (*read)(Mapper * mapper, uint16_t addr);
+  uint8_t * (*page)(Mapper * mapper, uint16_t addr, bool write); // optional
+};
+
+struct {
+  const char * name;
+  size_t offset;
+} symbol_map[] = {
+  {"mapper_create", offsetof(Mapper, create)},
+  {"mapper_destroy", offsetof(Mapper, destroy)},
+  {"mapper_write", offsetof(Mapper, write)},
+  {"mapper_read", offsetof(Mapper, read)}
+};
+
+static const MapperInterface * mapper_builtin(int mapper_no) {
+  for (size_t i = 0; i < ARRAY_LENGTH(mapper_builtins); ++i) {
+    if (mapper_builtins[i].mapper_no == mapper_no) {
+      return mapper_builtins[i].interface;
+    }
+  }
+  return NULL;
+}
+
+static GModule * mapper_load(int mapper_no) {
+  char * mapper_file;
+  asprintf(&mapper_file, "./mapper/mapper-%i", mapper_no);
+
+  // Try to load the module
+  GModule * module = g_module_open(mapper_file, G_MODULE_BIND_LAZY);
+
+  // Otherwise, try to compile mapper source code and try again
+  if (!module) {
+    char * compile_command;
+    asprintf(&compile_command,
+             "gcc -fPIC -shared -I./src -o %s.so %s.c",
+             mapper_file, mapper_file);
+
+    printf("%s\n", compile_command);
+    if (system(compile_command) == 0) {
+      module = g_module_open(mapper_file, G_MODULE_BIND_LAZY);
+    }
+  }
+
+  free(mapper_file);
+  return module;
+}
+
+static Mapper * mapper_banks_owner(MapperBanks * banks) {
+  return (Mapper *)((char *)banks - offsetof(struct Mapper, banks));
+}
+
+static void mapper_banks_changed(MapperBanks * banks) {
+  Mapper * mapper = mapper_banks_owner(banks);
+  if (mapper->changed) {
+    mapper->changed(mapper->changed_data);
+  }
+}
+
+static bool mapper_load_v1(Mapper * mapper) {
+  for (size_t i = 0; i < ARRAY_LENGTH(symbol_map); ++i) {
+    gpointer * symbol = (gpointer *)((char *)mapper + symbol_map[i].offset);
+    if (!g_module_symbol(mapper->module, symbol_map[i].name, symbol)) {
+      fprintf(stderr, "Failed to load symbol '%s' for mapper #%i\n",
+              symbol_map[i].name, mapper->cartridge->mapper_no);
+      return false;
+    }
+  }
+
+  // Mappers without direct pages are accessed through read and write
+  if (!g_module_symbol(mapper->module, "mapper_page", (gpointer *)&mapper->page)) {
+    mapper->page = NULL;
+  }
+
+  // A v1 mapper can't say what it switched, so it only gets the plain
+  // CHR layout, which is all mapper 0 needs
+  mapper_banks_chr(&mapper->banks, 0, MAPPER_CHR_WINDOWS, mapper->cartridge->chr_rom);
+
+  mapper->raw = mapper->create(mapper->cartridge);
+  return mapper->raw != NULL;
+}
+
+static bool mapper_load_v2(Mapper * mapper) {
+  if (mapper->interface->abi != MAPPER_ABI) {
+    fprintf(stderr, "Mapper #%i was built for ABI v%i, expected v%i\n",
+            mapper->cartridge->mapper_no, mapper->interface->abi, MAPPER_ABI);
+    return false;
+  }
+
+  mapper->raw = mapper->interface->create(mapper->cartridge, &mapper->banks);
+  return mapper->raw != NULL;
+}
+
+Mapper * mapper_create(Cartridge * cartridge) {
+  Mapper * mapper = g_malloc0(sizeof(Mapper));
+  int mapper_no = cartridge->mapper_no;
+
+  mapper->cartridge = cartridge;
+  mapper->banks.prg_ram = cartridge->save_ram;
+  mapper->banks.mirror = cartridge->mirror;
+  mapper->banks.changed = mapper_banks_changed;
+
+  mapper->interface = mapper_builtin(mapper_no);
+  if (mapper->interface) {
+    mapper->builtin = true;
+    if (!mapper_load_v2(mapper)) {
+      g_free(mapper);
+      return NULL;
+    }
+    return mapper;
+  }
+
+  if (!g_getenv("NES_MAPPER_PLUGINS")) {
+    fprintf(stderr, "Mapper #%i is not built in, set NES_MAPPER_PLUGINS to load it from ./mapper\n", mapper_no);
+    g_free(mapper);
+    return NULL;
+  }
+
+  mapper->module = mapper_load(mapper_no);
+  if (!mapper->module) {
+    fprintf(stderr, "Failed to load mapper #%i\n", mapper_no);
+    g_free(mapper);
+    return NULL;
+  }
+
+  bool loaded;
+  if (g_module_symbol(mapper->module, "mapper_interface", (gpointer *)&mapper->interface)) {
+    loaded = mapper_load_v2(mapper);
+  } else {
+    mapper->interface = NULL;
+    loaded = mapper_load_v1(mapper);
+  }
+
+  if (!loaded) {
+    g_module_close(mapper->module);
+    g_free(mapper);
+    return NULL;
+  }
+
+  return mapper;
+}
+
+void mapper_destroy(Mapper * mapper) {
+  if (mapper->interface) {
+    mapper->interface->destroy(mapper->raw);
+  } else {
+    mapper->destroy(mapper->raw);
+  }
+  if (mapper->module) {
+    g_module_close(mapper->module);
+  }
+  g_free(mapper);
+}
+
+/**
+ * Calls to built-in mappers go through their interface by name rather than
+ * through mapper->interface, so they resolve to direct calls under LTO
+ */
+static void mapper_builtin_write(Mapper * mapper, uint16_t addr, uint8_t val) {
+  switch (mapper->cartridge->mapper_no) {
+#define X(no) case no: mapper_interface_##no.write(mapper->raw, addr, val); break;
+  MAPPER_BUILTINS(X)
+#undef X
+  }
+}
+
+static void mapper_builtin_scanline(Mapper * mapper) {
+  switch (mapper->cartridge->mapper_no) {
+#define X(no)                                     \
+  case no:                                        \
+    if (mapper_interface_##no.scanline) {         \
+      mapper_interface_##no.scanline(mapper->raw); \
+    }                                             \
+    break;
+  MAPPER_BUILTINS(X)
+#undef X
+  }
+}
+
+// PRG RAM smaller than 8 KB repeats across $6000-$7FFF
+static uint32_t mapper_prg_ram_offset(Mapper * mapper, uint16_t addr) {
+  return (addr - 0x6000) % mapper->cartridge->save_ram_size;
+}
+
+void mapper_write(Mapper * mapper, uint16_t addr, uint8_t val) {
+  if (mapper->interface) {
+    if (addr >= 0x6000 && addr <= 0x7FFF && mapper->banks.prg_ram) {
+      if (!mapper->banks.prg_ram_readonly) {
+        mapper->banks.prg_ram[mapper_prg_ram_offset(mapper, addr)] = val;
+      }
+    } else if (mapper->builtin) {
+      mapper_builtin_write(mapper, addr, val);
+    } else {
+      mapper->interface->write(mapper->raw, addr, val);
+    }
+  } else {
+    mapper->write(mapper->raw, addr, val);
+
+    // Any write may have switched banks
+    if (mapper->changed) {
+      mapper->changed(mapper->changed_data);
+    }
+  }
+}
+
+uint8_t mapper_read(Mapper * mapper, uint16_t addr) {
+  if (!mapper->interface) {
+    return mapper->read(mapper->raw, addr);
+  }
+
+  if (addr >= 0x6000 && addr <= 0x7FFF) {
+    uint8_t * prg_ram = mapper->banks.prg_ram;
+    return prg_ram ? prg_ram[mapper_prg_ram_offset(mapper, addr)] : 0;
+  }
+
+  uint8_t * page = mapper_page(mapper, addr, false);
+  return page ? page[addr & 0xFF] : 0;
+}
+
+/**
+ * Host memory behind a 256 byte page of the CPU address space, or NULL if
+ * accesses to it must go through mapper_read and mapper_write
+ */
+uint8_t * mapper_page(Mapper * mapper, uint16_t addr, bool write) {
+  if (!mapper->interface) {
+    return mapper->page ? mapper->page(mapper->raw, addr, write) : NULL;
+  }
+
+  MapperBanks * banks = &mapper->banks;
+  if (addr >= 0x6000 && addr <= 0x7FFF) {
+    // Less than a page of RAM can't be mapped, it goes through the handlers
+    if (!banks->prg_ram || (write && banks->prg_ram_readonly) || mapper->cartridge->save_ram_size < 0x100) {
+      return NULL;
+    }
+    return banks->prg_ram + (mapper_prg_ram_offset(mapper, addr) & ~0xFF);
+
+  } else if (addr >= 0x8000 && !write) {
+    uint8_t * bank = banks->prg[(addr - 0x8000) / MAPPER_PRG_WINDOW_SIZE];
+    return bank ? bank + ((addr - 0x8000) % MAPPER_PRG_WINDOW_SIZE & ~0xFF) : NULL;
+  }
+
+  return NULL;
+}
+
+// A v1 mapper serves its own reads, what it returns may change on any write
+bool mapper_hides_banks(Mapper * mapper) {
+  return mapper->interface == NULL;
+}
+
+const MapperBanks * mapper_banks(Mapper * mapper) {
+  return &mapper->banks;
+}
+
+// Whether mapper_scanline does anything, so the PPU can skip calling it
+bool mapper_has_scanline(Mapper * mapper) {
+  return mapper->interface && mapper->interface->scanline;
+}
+
+void mapper_scanline(Mapper * mapper) {
+  if (mapper->builtin) {
+    mapper_builtin_scanline(mapper);
+  } else if (mapper->interface && mapper->interface->scanline) {
+    mapper->interface->scanline(mapper->raw);
+  }
+}
+
+// Register the function to call whenever the mapper switches banks
+void mapper_on_change(Mapper * mapper, MapperChanged callback, void * data) {
+  mapper->changed = callback;
+  mapper->changed_data = data;
+}
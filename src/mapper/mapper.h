@@ -2,13 +2,101 @@
 #define MAPPER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "cartridge/cartridge.r"
 
 typedef struct Mapper Mapper;
 
+/**
+ * Mapper ABI v2
+ *
+ * Instead of handling every byte read from the cartridge, a v2 mapper
+ * publishes what is currently switched into each window of the CPU and
+ * PPU address spaces, and calls changed whenever it switches something.
+ * The core reads PRG and CHR straight from those pointers, so the only
+ * calls into the mapper are writes to its registers.
+ *
+ * A v2 mapper defines its MapperInterface with MAPPER_INTERFACE. Plugins
+ * exporting mapper_create, mapper_destroy, mapper_write and mapper_read
+ * instead are loaded as v1, and see every access.
+ */
+
+#define MAPPER_ABI 2
+
+#define MAPPER_PRG_WINDOWS 4
+#define MAPPER_PRG_WINDOW_SIZE 0x2000 // $8000-$FFFF in 8 KB
+#define MAPPER_CHR_WINDOWS 8
+#define MAPPER_CHR_WINDOW_SIZE 0x0400 // PPU $0000-$1FFF in 1 KB
+
+typedef struct MapperBanks MapperBanks;
+struct MapperBanks {
+  uint8_t * prg[MAPPER_PRG_WINDOWS];
+  uint8_t * chr[MAPPER_CHR_WINDOWS];
+  uint8_t * prg_ram; // $6000-$7FFF, NULL when disabled
+  bool prg_ram_readonly;
+  Mirror mirror;
+  bool irq; // IRQ line driven by the mapper, call changed when it moves
+
+  // Set by the core, call after switching anything above
+  void (*changed)(MapperBanks * banks);
+};
+
+typedef struct MapperInterface MapperInterface;
+struct MapperInterface {
+  int abi; // MAPPER_ABI
+
+  // Fill in the initial banks, which stay owned by the core
+  Mapper * (*create)(Cartridge * cartridge, MapperBanks * banks);
+  void (*destroy)(Mapper * mapper);
+
+  // Writes to $4020-$FFFF that don't land in PRG RAM
+  void (*write)(Mapper * mapper, uint16_t addr, uint8_t val);
+
+  // Optional, clocked once per rendered scanline
+  void (*scanline)(Mapper * mapper);
+};
+
+/**
+ * Mappers compiled into the binary, keep in sync with MAPPERS in the
+ * Makefile. Built in, each interface is named after its mapper number,
+ * as a plugin it's always mapper_interface.
+ */
+#define MAPPER_BUILTINS(X) X(0) X(1) X(2) X(3) X(4)
+
+#ifdef MAPPER_BUILTIN
+#define MAPPER_INTERFACE(no) const MapperInterface mapper_interface_##no
+#else
+#define MAPPER_INTERFACE(no) const MapperInterface mapper_interface
+#endif
+
+// Point each window at consecutive pieces of a bank
+static inline void mapper_banks_prg(MapperBanks * banks, int window, int count, uint8_t * bank) {
+  for (int i = 0; i < count; ++i) {
+    banks->prg[window + i] = bank + i * MAPPER_PRG_WINDOW_SIZE;
+  }
+}
+
+static inline void mapper_banks_chr(MapperBanks * banks, int window, int count, uint8_t * bank) {
+  for (int i = 0; i < count; ++i) {
+    banks->chr[window + i] = bank + i * MAPPER_CHR_WINDOW_SIZE;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Used by the core
+
+typedef void (*MapperChanged)(void * data);
+
 Mapper * mapper_create(Cartridge * cartridge);
 void mapper_destroy(Mapper * mapper);
 void mapper_write(Mapper * mapper, uint16_t addr, uint8_t val);
 uint8_t mapper_read(Mapper * mapper, uint16_t addr);
+uint8_t * mapper_page(Mapper * mapper, uint16_t addr, bool write);
+bool mapper_hides_banks(Mapper * mapper);
+
+const MapperBanks * mapper_banks(Mapper * mapper);
+bool mapper_has_scanline(Mapper * mapper);
+void mapper_scanline(Mapper * mapper);
+void mapper_on_change(Mapper * mapper, MapperChanged callback, void * data);
 
 #endif
@@ -17,29 +17,52 @@ static Cartridge * memory_cartridge(Memory * mem) {
   return memory_nes(mem)->cartridge;
 }
 
-static APU * memory_apu(Memory * mem) {
-  return &memory_nes(mem)->apu;
+static CPU * memory_cpu(Memory * mem) {
+  return &memory_nes(mem)->cpu;
 }
 
-////////////////////////////////////////////////////////////////////////////////
+// The APU and PPU run behind the CPU, catch them up before touching them
+static APU * memory_apu(Memory * mem) {
+  NES * nes = memory_nes(mem);
+  nes_sync_apu(nes, nes->cpu.clock);
+  return &nes->apu;
+}
 
-void memory_init(Memory * mem) {
-  memory_reset(mem);
+static PPU * memory_ppu(Memory * mem) {
+  NES * nes = memory_nes(mem);
+  nes_sync_ppu(nes, nes->cpu.clock);
+  return &nes->ppu;
 }
 
-void memory_reset(Memory * mem) {
-  memset(mem->ram, 0, MEMORY_RAM_SIZE);
+/**
+ * Copy a page into OAM. The CPU is halted while it happens, for an extra
+ * cycle when the DMA starts on an odd one.
+ */
+static void memory_oam_dma(Memory * mem, uint8_t page) {
+  uint8_t data[256];
+  for (int i = 0; i < 256; ++i) {
+    data[i] = memory_read(mem, page << 8 | i);
+  }
+  ppu_oam_dma(memory_ppu(mem), data);
+
+  CPU * cpu = memory_cpu(mem);
+  cpu->clock += 513 + (cpu->clock & 1);
 }
 
-uint8_t memory_read(Memory * mem, uint16_t addr) {
-  if (addr <= MEMORY_RAM_END) {
-    return mem->ram[addr % MEMORY_RAM_SIZE];
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t memory_io_read(Memory * mem, uint16_t addr) {
+  if (addr >= MEMORY_PPU && addr <= MEMORY_PPU_END) {
+    return ppu_read(memory_ppu(mem), addr % PPU_ADDRESS_SIZE);
 
   } else if (addr >= MEMORY_WAVEFORMS && addr <= MEMORY_WAVEFORMS_END) {
     return apu_read(memory_apu(mem), APU_WAVEFORMS + (addr - MEMORY_WAVEFORMS));
 
   } else if (addr == MEMORY_APU_STATUS) {
-    return apu_read(memory_apu(mem), APU_STATUS);
+    // Reading acknowledges the frame interrupt
+    uint8_t val = apu_read(memory_apu(mem), APU_STATUS);
+    nes_apu_irq(memory_nes(mem));
+    return val;
 
   } else if (addr == MEMORY_APU_FRAME_COUNTER) {
     return apu_read(memory_apu(mem), APU_FRAME_COUNTER);
@@ -56,18 +79,30 @@ uint8_t memory_read(Memory * mem, uint16_t addr) {
   return 0;
 }
 
-void memory_write(Memory * mem, uint16_t addr, uint8_t val) {
-  if (addr <= MEMORY_RAM_END) {
-    mem->ram[addr % MEMORY_RAM_SIZE] = val;
+static void memory_io_write(Memory * mem, uint16_t addr, uint8_t val) {
+  if (addr >= MEMORY_PPU && addr <= MEMORY_PPU_END) {
+    PPU * ppu = memory_ppu(mem);
+    ppu_write(ppu, addr % PPU_ADDRESS_SIZE, val);
+    if (addr % PPU_ADDRESS_SIZE == PPU_MASK) {
+      // Turning rendering on or off starts or stops the scanline events
+      nes_schedule(memory_nes(mem), EVENT_PPU, ppu_next_event(ppu));
+    }
+
+  } else if (addr == MEMORY_OAM_DMA) {
+    memory_oam_dma(mem, val);
 
   } else if (addr >= MEMORY_WAVEFORMS && addr <= MEMORY_WAVEFORMS_END) {
     apu_write(memory_apu(mem), APU_WAVEFORMS + (addr - MEMORY_WAVEFORMS), val);
 
   } else if (addr == MEMORY_APU_STATUS) {
     apu_write(memory_apu(mem), APU_STATUS, val);
+    nes_apu_irq(memory_nes(mem));
 
   } else if (addr == MEMORY_APU_FRAME_COUNTER) {
-    apu_write(memory_apu(mem), APU_FRAME_COUNTER, val);
+    APU * apu = memory_apu(mem);
+    apu_write(apu, APU_FRAME_COUNTER, val);
+    nes_schedule(memory_nes(mem), EVENT_APU_FRAME, apu_next_step(apu));
+    nes_apu_irq(memory_nes(mem));
 
   } else if (addr >= MEMORY_CARTRIDGE) {
     Cartridge * cartridge = memory_cartridge(mem);
@@ -78,3 +113,113 @@ void memory_write(Memory * mem, uint16_t addr, uint8_t val) {
     assert(false);
   }
 }
+
+static uint8_t memory_cartridge_read(Memory * mem, uint16_t addr) {
+  Cartridge * cartridge = memory_cartridge(mem);
+  if (cartridge) {
+    return cartridge_read(cartridge, addr);
+  }
+  return 0;
+}
+
+// Anything the mapper switches only shows on lines the PPU hasn't drawn yet
+static void memory_cartridge_write(Memory * mem, uint16_t addr, uint8_t val) {
+  Cartridge * cartridge = memory_cartridge(mem);
+  if (cartridge) {
+    NES * nes = memory_nes(mem);
+    nes_sync_ppu(nes, nes->cpu.clock);
+    cartridge_write(cartridge, addr, val);
+  }
+}
+
+// Battery backed RAM is stored to directly, the save only has to know it changed
+static void memory_save_write(Memory * mem, uint16_t addr, uint8_t val) {
+  mem->save_page[addr >> 8][addr & 0xFF] = val;
+  cartridge_save_written(memory_cartridge(mem));
+}
+
+/**
+ * Point the cartridge pages at whatever the mapper has switched in,
+ * leaving the pages it can't map directly to the handlers
+ */
+static void memory_map_cartridge(Memory * mem) {
+  Cartridge * cartridge = memory_cartridge(mem);
+  for (int page = MEMORY_CARTRIDGE / MEMORY_PAGE_SIZE + 1; page < MEMORY_PAGES; ++page) {
+    uint16_t addr = page * MEMORY_PAGE_SIZE;
+    mem->read_page[page] = cartridge ? cartridge_page(cartridge, addr, false) : NULL;
+    mem->write_page[page] = cartridge ? cartridge_page(cartridge, addr, true) : NULL;
+    mem->save_page[page] = cartridge ? cartridge_save_page(cartridge, addr) : NULL;
+    mem->write_handler[page] = mem->save_page[page] ? memory_save_write : memory_cartridge_write;
+  }
+}
+
+/**
+ * The mapper switched banks. Code the CPU has decoded from pages that now
+ * point elsewhere is stale. So is code behind pages only a v1 mapper can
+ * read, since there's no telling what changed under those.
+ *
+ * The mapper's IRQ line is published the same way.
+ */
+static void memory_cartridge_changed(void * data) {
+  Memory * mem = data;
+  cpu_irq(memory_cpu(mem), CPU_IRQ_MAPPER, cartridge_irq(memory_cartridge(mem)));
+
+  uint8_t * before[MEMORY_PAGES];
+  memcpy(before, mem->read_page, sizeof(before));
+
+  memory_map_cartridge(mem);
+
+  Cartridge * cartridge = memory_cartridge(mem);
+  bool hidden = cartridge && cartridge_hides_banks(cartridge);
+
+  int first = MEMORY_PAGES, last = -1;
+  for (int page = MEMORY_CARTRIDGE / MEMORY_PAGE_SIZE + 1; page < MEMORY_PAGES; ++page) {
+    if (mem->read_page[page] != before[page] || (hidden && !mem->read_page[page])) {
+      if (first == MEMORY_PAGES) {
+        first = page;
+      }
+      last = page;
+    }
+  }
+
+  if (last >= 0) {
+    cpu_cache_remap(memory_cpu(mem), first * MEMORY_PAGE_SIZE, last * MEMORY_PAGE_SIZE + 0xFF);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void memory_init(Memory * mem) {
+  memory_reset(mem);
+}
+
+void memory_reset(Memory * mem) {
+  memset(mem->ram, 0, MEMORY_RAM_SIZE);
+
+  // RAM is mirrored four times up to $2000
+  int page = 0;
+  for (; page < (MEMORY_RAM_END + 1) / MEMORY_PAGE_SIZE; ++page) {
+    uint8_t * ram = mem->ram + (page * MEMORY_PAGE_SIZE) % MEMORY_RAM_SIZE;
+    mem->read_page[page] = ram;
+    mem->write_page[page] = ram;
+  }
+
+  // PPU and APU registers, and the start of the cartridge space
+  for (; page <= MEMORY_CARTRIDGE / MEMORY_PAGE_SIZE; ++page) {
+    mem->read_page[page] = NULL;
+    mem->write_page[page] = NULL;
+    mem->read_handler[page] = memory_io_read;
+    mem->write_handler[page] = memory_io_write;
+  }
+
+  for (; page < MEMORY_PAGES; ++page) {
+    mem->read_handler[page] = memory_cartridge_read;
+    mem->write_handler[page] = memory_cartridge_write;
+  }
+
+  Cartridge * cartridge = memory_cartridge(mem);
+  if (cartridge) {
+    cartridge_on_change(cartridge, memory_cartridge_changed, mem);
+  }
+  memory_map_cartridge(mem);
+}
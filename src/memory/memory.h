@@ -2,6 +2,7 @@
 #define MEMORY_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 /**
  * References:
@@ -16,23 +17,60 @@
 #define MEMORY_STACK 0x0100
 #define MEMORY_STACK_END 0x01FF
 
+#define MEMORY_PPU 0x2000
+#define MEMORY_PPU_END 0x3FFF // Mirrors of $2000-$2007
+
 #define MEMORY_WAVEFORMS 0x4000
 #define MEMORY_WAVEFORMS_END 0x4013
+#define MEMORY_OAM_DMA 0x4014
 #define MEMORY_APU_STATUS 0x4015
 #define MEMORY_APU_FRAME_COUNTER 0x4017
 
 #define MEMORY_CARTRIDGE 0x4020
 #define MEMORY_CARTRIDGE_END 0xFFFF
 
+#define MEMORY_PAGE_SIZE 0x100
+#define MEMORY_PAGES 0x100
+
 typedef struct Memory Memory;
+
+typedef uint8_t (*MemoryReadHandler)(Memory * mem, uint16_t addr);
+typedef void (*MemoryWriteHandler)(Memory * mem, uint16_t addr, uint8_t val);
+
+/**
+ * The bus is a table of 256 byte pages. A page that is plain memory holds a
+ * host pointer to its first byte, and is accessed with a single load or
+ * store. Any other page has a NULL pointer and goes through its handler.
+ * Cartridge pages are mapped again whenever the mapper switches banks.
+ */
 struct Memory {
   uint8_t ram[MEMORY_RAM_SIZE];
+
+  uint8_t * read_page[MEMORY_PAGES];
+  uint8_t * write_page[MEMORY_PAGES];
+  MemoryReadHandler read_handler[MEMORY_PAGES];
+  MemoryWriteHandler write_handler[MEMORY_PAGES];
+  uint8_t * save_page[MEMORY_PAGES]; // battery backed RAM, see memory_save_write
 };
 
 void memory_init(Memory * mem);
 void memory_reset(Memory * mem);
 
-uint8_t memory_read(Memory * mem, uint16_t addr);
-void memory_write(Memory * mem, uint16_t addr, uint8_t val);
+static inline uint8_t memory_read(Memory * mem, uint16_t addr) {
+  uint8_t * page = mem->read_page[addr >> 8];
+  if (page) {
+    return page[addr & 0xFF];
+  }
+  return mem->read_handler[addr >> 8](mem, addr);
+}
+
+static inline void memory_write(Memory * mem, uint16_t addr, uint8_t val) {
+  uint8_t * page = mem->write_page[addr >> 8];
+  if (page) {
+    page[addr & 0xFF] = val;
+  } else {
+    mem->write_handler[addr >> 8](mem, addr, val);
+  }
+}
 
 #endif
@@ -1,19 +1,341 @@
 #include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
 
 #include "nes.h"
+#include "cartridge/cartridge.r"
+#include "array.h"
+
+/**
+ * Idle loops the CPU can't judge on its own, by SHA-1 of the PRG ROM and
+ * address of the loop head. CPU_IDLE_ALWAYS is for loops that poll an
+ * I/O register which only changes at an event, CPU_IDLE_NEVER for loops
+ * that must run every iteration.
+ */
+static const struct {
+  const char * prg_sha1;
+  uint16_t addr;
+  CPUIdleOverride override;
+} nes_idle_overrides[] = {
+  {NULL, 0, CPU_IDLE_DETECT}
+};
+
+#define NES_COTHREAD_STACK (256 * 1024)
+
+/**
+ * Run the APU through a frame counter step and wait for the next one.
+ * Steps are where the envelopes, sweeps and length counters are clocked,
+ * and where the frame interrupt is raised.
+ */
+static void nes_apu_frame(void * data, int time) {
+  NES * nes = data;
+  nes_sync_apu(nes, time);
+  nes_apu_irq(nes);
+  nes_schedule(nes, EVENT_APU_FRAME, apu_next_step(&nes->apu));
+}
+
+// Run the PPU through vertical blank or a scanline, and wait for the next
+static void nes_ppu_event(void * data, int time) {
+  NES * nes = data;
+  nes_sync_ppu(nes, time);
+  nes_schedule(nes, EVENT_PPU, ppu_next_event(&nes->ppu));
+}
 
 void nes_init(NES * nes) {
   nes->cartridge = NULL;
   memory_init(&nes->mem);
   cpu_init(&nes->cpu);
   apu_init(&nes->apu);
+  ppu_init(&nes->ppu);
+  memset(nes->framebuffer, 0, sizeof(nes->framebuffer));
+  memset(nes->emphasis, 0, sizeof(nes->emphasis));
+
+  scheduler_init(&nes->scheduler);
+  scheduler_register(&nes->scheduler, EVENT_APU_FRAME, nes_apu_frame, nes);
+  scheduler_register(&nes->scheduler, EVENT_PPU, nes_ppu_event, nes);
+
+  nes->sync = NES_SYNC_SCHEDULER;
+  nes->threads.host = NULL;
+  nes->threads.cpu = NULL;
+  nes->threads.apu = NULL;
+  nes->threads.ppu = NULL;
 }
 
-void nes_load(NES * nes, Cartridge * cartridge) {
-  nes->cartridge = cartridge;
+void nes_deinit(NES * nes) {
+  if (nes->threads.cpu) {
+    cothread_destroy(nes->threads.cpu);
+    cothread_destroy(nes->threads.apu);
+    cothread_destroy(nes->threads.ppu);
+    nes->threads.cpu = NULL;
+    nes->threads.apu = NULL;
+    nes->threads.ppu = NULL;
+  }
+  cpu_deinit(&nes->cpu);
+}
+
+void nes_reset(NES * nes) {
   memory_reset(&nes->mem);
   cpu_reset(&nes->cpu);
   apu_reset(&nes->apu);
+  ppu_reset(&nes->ppu);
+
+  scheduler_reset(&nes->scheduler);
+  nes_schedule(nes, EVENT_APU_FRAME, apu_next_step(&nes->apu));
+  nes_schedule(nes, EVENT_PPU, ppu_next_event(&nes->ppu));
+}
+
+void nes_load(NES * nes, Cartridge * cartridge) {
+  nes->cartridge = cartridge;
+  nes_reset(nes);
+
+  cpu_idle_clear_overrides(&nes->cpu);
+  for (size_t i = 0; nes_idle_overrides[i].prg_sha1 != NULL; ++i) {
+    if (strcmp(nes_idle_overrides[i].prg_sha1, cartridge->prg_sha1) == 0) {
+      cpu_idle_override(&nes->cpu, nes_idle_overrides[i].addr, nes_idle_overrides[i].override);
+    }
+  }
+
   // TODO: DEBUG
   cpu_debug(&nes->cpu);
 }
+
+static void nes_run_events(NES * nes, int clock) {
+  while (nes->cpu.clock < clock) {
+    int next = scheduler_next(&nes->scheduler);
+    if (next > clock) {
+      next = clock;
+    }
+
+    cpu_run(&nes->cpu, next - nes->cpu.clock);
+    scheduler_dispatch(&nes->scheduler, nes->cpu.clock);
+  }
+
+  // Leave the APU up to date for the audio thread, and the PPU for the
+  // frame to show
+  nes_sync_apu(nes, nes->cpu.clock);
+  nes_sync_ppu(nes, nes->cpu.clock);
+}
+
+static void nes_cpu_thread(void * data) {
+  NES * nes = data;
+  while (true) {
+    nes_run_events(nes, nes->threads.cpu_target);
+    cothread_switch(nes->threads.host);
+  }
+}
+
+// Catch-up calls on their own stacks, see NES_SYNC_COTHREAD
+static void nes_apu_thread(void * data) {
+  NES * nes = data;
+  while (true) {
+    apu_run_until(&nes->apu, nes->threads.apu_target);
+    cothread_switch(nes->threads.cpu);
+  }
+}
+
+static void nes_ppu_thread(void * data) {
+  NES * nes = data;
+  while (true) {
+    ppu_run_until(&nes->ppu, nes->threads.ppu_target);
+    cothread_switch(nes->threads.cpu);
+  }
+}
+
+static bool nes_create_threads(NES * nes) {
+  if (nes->threads.cpu) {
+    return true;
+  }
+
+  nes->threads.cpu = cothread_create(NES_COTHREAD_STACK, nes_cpu_thread, nes);
+  nes->threads.apu = cothread_create(NES_COTHREAD_STACK, nes_apu_thread, nes);
+  nes->threads.ppu = cothread_create(NES_COTHREAD_STACK, nes_ppu_thread, nes);
+  if (!nes->threads.cpu || !nes->threads.apu || !nes->threads.ppu) {
+    if (nes->threads.cpu) cothread_destroy(nes->threads.cpu);
+    if (nes->threads.apu) cothread_destroy(nes->threads.apu);
+    if (nes->threads.ppu) cothread_destroy(nes->threads.ppu);
+    nes->threads.cpu = NULL;
+    nes->threads.apu = NULL;
+    nes->threads.ppu = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Run the NES up to the given CPU cycle. The CPU runs freely until the
+ * earliest pending event, then the events that are due are handled, until
+ * the target is reached. Everything else catches up to the CPU on demand.
+ */
+void nes_run(NES * nes, int clock) {
+  if (nes->sync == NES_SYNC_COTHREAD && nes_create_threads(nes)) {
+    nes->threads.host = cothread_active();
+    nes->threads.cpu_target = clock;
+    cothread_switch(nes->threads.cpu);
+  } else {
+    nes_run_events(nes, clock);
+  }
+}
+
+/**
+ * Schedule an event on the CPU clock. An event that lands before the CPU
+ * would otherwise stop pulls its deadline in, so it can be scheduled from
+ * within an instruction.
+ */
+void nes_schedule(NES * nes, Event event, int time) {
+  scheduler_set(&nes->scheduler, event, time);
+  if (time < nes->cpu.deadline) {
+    nes->cpu.deadline = time;
+  }
+}
+
+/**
+ * Catch the APU up to a CPU cycle before it is touched. On the cothread
+ * model this is where the CPU hands over to the APU, which is always the
+ * component furthest behind when the CPU gets here.
+ */
+void nes_sync_apu(NES * nes, int time) {
+  if (nes->sync == NES_SYNC_COTHREAD && cothread_active() == nes->threads.cpu) {
+    nes->threads.apu_target = time;
+    cothread_switch(nes->threads.apu);
+  } else {
+    apu_run_until(&nes->apu, time);
+  }
+}
+
+// Catch the PPU up to a CPU cycle before it is touched, the same way
+void nes_sync_ppu(NES * nes, int time) {
+  if (nes->sync == NES_SYNC_COTHREAD && cothread_active() == nes->threads.cpu) {
+    nes->threads.ppu_target = time;
+    cothread_switch(nes->threads.ppu);
+  } else {
+    ppu_run_until(&nes->ppu, time);
+  }
+}
+
+/**
+ * Clocks count CPU cycles since reset, and would overflow after about 20
+ * minutes. Call this between nes_run calls to move all of them back by
+ * the cycles it returns, which the next target has to be moved back by
+ * too. The cycles are even, so the parity OAM DMA depends on is kept.
+ */
+int nes_rebase(NES * nes) {
+  int cycles = nes->cpu.clock & ~1;
+
+  cpu_rebase(&nes->cpu, cycles);
+  scheduler_rebase(&nes->scheduler, cycles);
+  nes->ppu.clock -= cycles;
+  nes->apu.clock -= cycles;
+  nes->apu.frame_clock -= cycles;
+
+  return cycles;
+}
+
+// The last frame the PPU completed, PPU_HEIGHT rows of PPU_WIDTH indices
+const uint8_t * nes_framebuffer(NES * nes) {
+  return &nes->framebuffer[(nes->ppu.frame & 1) ^ 1][0][0];
+}
+
+// The emphasis bits of each line of nes_framebuffer
+const uint8_t * nes_emphasis(NES * nes) {
+  return nes->emphasis[(nes->ppu.frame & 1) ^ 1];
+}
+
+// Follow the interrupt flags of the APU on the CPU's IRQ line
+void nes_apu_irq(NES * nes) {
+  cpu_irq(&nes->cpu, CPU_IRQ_FRAME, apu_frame_irq(&nes->apu));
+  cpu_irq(&nes->cpu, CPU_IRQ_DMC, apu_dmc_irq(&nes->apu));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static double nes_bench_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void nes_bench_report(const char * name, int cycles, double seconds) {
+  printf("%-10s %11i cycles %8.3fs %8.2f MHz\n",
+         name, cycles, seconds, cycles / seconds / 1e6);
+}
+
+/**
+ * Compare ways of keeping the APU and PPU in sync with the CPU over the same
+ * number of cycles from reset. Lockstep catches both up and handles the
+ * events that are due after every instruction, the others run frame sized
+ * slices through nes_run.
+ */
+void nes_bench(NES * nes, int cycles) {
+  static const int frame = 29781;
+  NESSync sync = nes->sync;
+
+  nes_reset(nes);
+  double start = nes_bench_seconds();
+  while (nes->cpu.clock < cycles) {
+    cpu_next_instr(&nes->cpu);
+    apu_run_until(&nes->apu, nes->cpu.clock);
+    ppu_run_until(&nes->ppu, nes->cpu.clock);
+    scheduler_dispatch(&nes->scheduler, nes->cpu.clock);
+  }
+  nes_bench_report("lockstep", nes->cpu.clock, nes_bench_seconds() - start);
+
+  static const struct {
+    const char * name;
+    NESSync sync;
+  } modes[] = {
+    {"scheduler", NES_SYNC_SCHEDULER},
+    {"cothread", NES_SYNC_COTHREAD},
+  };
+
+  for (size_t i = 0; i < ARRAY_LENGTH(modes); ++i) {
+    nes->sync = modes[i].sync;
+    nes_reset(nes);
+
+    start = nes_bench_seconds();
+    for (int target = frame; nes->cpu.clock < cycles; target += frame) {
+      nes_run(nes, target);
+    }
+    nes_bench_report(modes[i].name, nes->cpu.clock, nes_bench_seconds() - start);
+  }
+
+  nes->sync = sync;
+  nes_reset(nes);
+}
+
+/**
+ * Run frames the way the UI does, rebasing the clocks after each one, to
+ * check that nothing breaks once more cycles have gone by than an int holds
+ */
+void nes_soak(NES * nes, int frames) {
+  static const int frame = 29781;
+  float samples[1024];
+
+  nes_reset(nes);
+  double start = nes_bench_seconds();
+  int64_t cycles = 0;
+  int target = 0;
+
+  for (int i = 0; i < frames; ++i) {
+    target += frame;
+    nes_run(nes, target);
+
+    apu_end_frame(&nes->apu);
+    while (apu_read_samples(&nes->apu, samples, ARRAY_LENGTH(samples)) > 0) {
+      continue;
+    }
+
+    int rebase = nes_rebase(nes);
+    target -= rebase;
+    cycles += rebase;
+  }
+  cycles += nes->cpu.clock;
+
+  printf("%" PRId64 " cycles, %i frames drawn, %.3fs\n",
+         cycles, nes->ppu.frame, nes_bench_seconds() - start);
+  printf("Clocks end at CPU %i, PPU %i, APU %i\n",
+         nes->cpu.clock, nes->ppu.clock, nes->apu.clock);
+
+  nes_reset(nes);
+}
@@ -5,6 +5,31 @@
 #include "memory/memory.h"
 #include "cpu/cpu.h"
 #include "apu/apu.h"
+#include "ppu/ppu.h"
+#include "scheduler.h"
+#include "cothread.h"
+
+/**
+ * How the components are kept in sync with the CPU
+ *
+ * NES_SYNC_SCHEDULER: the CPU runs up to the next event, the APU and
+ *   PPU are caught up with a call whenever they are touched.
+ *
+ * NES_SYNC_COTHREAD: the CPU, APU and PPU run on their own cothreads.
+ *   The CPU runs ahead until it touches the APU or PPU, then switches to
+ *   it so it can catch up, and it switches back once it has.
+ *
+ * The two modes are equivalent on purpose. Only the CPU ever runs ahead,
+ * so the component a switch goes to is always the one furthest behind,
+ * and its cothread does exactly what the catch-up call would, on its own
+ * stack. Letting the APU or PPU run ahead too would mean undoing work
+ * whenever the CPU writes to them. The cothread mode is kept to measure
+ * what the switches cost, see nes_bench.
+ */
+typedef enum {
+  NES_SYNC_SCHEDULER,
+  NES_SYNC_COTHREAD
+} NESSync;
 
 typedef struct NES NES;
 struct NES {
@@ -12,9 +37,42 @@ struct NES {
   Memory mem;
   CPU cpu;
   APU apu;
+  PPU ppu;
+  Scheduler scheduler;
+
+  // Palette indices. The PPU draws into one while the other holds the
+  // last complete frame, see nes_framebuffer. Each line also keeps the
+  // PPUMASK emphasis bits it was drawn with.
+  uint8_t framebuffer[2][PPU_HEIGHT][PPU_WIDTH];
+  uint8_t emphasis[2][PPU_HEIGHT];
+
+  NESSync sync;
+  struct {
+    Cothread * host; // the thread nes_run was called from
+    Cothread * cpu;
+    Cothread * apu;
+    Cothread * ppu;
+    int cpu_target;
+    int apu_target;
+    int ppu_target;
+  } threads;
 };
 
 void nes_init(NES * nes);
+void nes_deinit(NES * nes);
+void nes_reset(NES * nes);
 void nes_load(NES * nes, Cartridge * cartridge);
 
+void nes_run(NES * nes, int clock);
+void nes_schedule(NES * nes, Event event, int time);
+void nes_sync_apu(NES * nes, int time);
+void nes_sync_ppu(NES * nes, int time);
+const uint8_t * nes_framebuffer(NES * nes);
+const uint8_t * nes_emphasis(NES * nes);
+int nes_rebase(NES * nes);
+void nes_apu_irq(NES * nes);
+
+void nes_bench(NES * nes, int cycles);
+void nes_soak(NES * nes, int frames);
+
 #endif
@@ -0,0 +1,176 @@
+#include "compose.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COMPOSE_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Palette lookups are byte shuffles into the 16 background and the 16
+ * sprite entries, which needs SSSE3 at least. Without it every pixel
+ * goes through compose_line_scalar.
+ */
+
+typedef int (*ComposeLine)(uint8_t * out, const uint8_t * bg, const uint8_t * sprites, const uint8_t * palette, int flags);
+
+static int compose_line_scalar(uint8_t * out, const uint8_t * bg, const uint8_t * sprites, const uint8_t * palette, int flags) {
+  uint8_t mask = (flags & COMPOSE_GRAYSCALE) ? 0x30 : 0x3F;
+  int hit = -1;
+
+  for (int x = 0; x < COMPOSE_WIDTH; ++x) {
+    uint8_t b = (x >= 8 || (flags & COMPOSE_BG_LEFT)) ? bg[x] : 0;
+    uint8_t s = (x >= 8 || (flags & COMPOSE_SPRITES_LEFT)) ? sprites[x] : 0;
+
+    uint8_t index = 0;
+    if ((s & 3) && (!(s & 0x20) || !(b & 3))) {
+      index = 0x10 | (s & 0x0F);
+    } else if (b & 3) {
+      index = b & 0x0F;
+    }
+    out[x] = palette[index] & mask;
+
+    if ((s & 0x40) && (b & 3) && x != COMPOSE_WIDTH - 1 && hit < 0) {
+      hit = x;
+    }
+  }
+
+  return hit;
+}
+
+#ifdef COMPOSE_X86
+
+// The leftmost 8 bytes of the first vector, cleared when that column is clipped
+static const uint8_t compose_left[2][16] = {
+  {0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+  {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+};
+
+/*
+ * Both versions do the same per byte: a pixel of either layer is
+ * transparent when its color is 0, and the background shows when the
+ * sprite is transparent or behind an opaque background. The sprite 0 hit
+ * is any sprite 0 pixel over an opaque background, apart from at x 255.
+ */
+
+__attribute__((target("ssse3")))
+static int compose_line_ssse3(uint8_t * out, const uint8_t * bg, const uint8_t * sprites, const uint8_t * palette, int flags) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i color = _mm_set1_epi8(0x03);
+  const __m128i index = _mm_set1_epi8(0x0F);
+  const __m128i priority = _mm_set1_epi8(0x20);
+  const __m128i sprite0 = _mm_set1_epi8(0x40);
+  const __m128i mask = _mm_set1_epi8((flags & COMPOSE_GRAYSCALE) ? 0x30 : 0x3F);
+  const __m128i bg_palette = _mm_loadu_si128((const __m128i *)palette);
+  const __m128i sprite_palette = _mm_loadu_si128((const __m128i *)(palette + 16));
+  const __m128i bg_left = _mm_loadu_si128((const __m128i *)compose_left[(flags & COMPOSE_BG_LEFT) != 0]);
+  const __m128i sprites_left = _mm_loadu_si128((const __m128i *)compose_left[(flags & COMPOSE_SPRITES_LEFT) != 0]);
+  int hit = -1;
+
+  for (int x = 0; x < COMPOSE_WIDTH; x += 16) {
+    __m128i b = _mm_loadu_si128((const __m128i *)(bg + x));
+    __m128i s = _mm_loadu_si128((const __m128i *)(sprites + x));
+    if (x == 0) {
+      b = _mm_and_si128(b, bg_left);
+      s = _mm_and_si128(s, sprites_left);
+    }
+
+    __m128i bg_clear = _mm_cmpeq_epi8(_mm_and_si128(b, color), zero);
+    __m128i sprite_clear = _mm_cmpeq_epi8(_mm_and_si128(s, color), zero);
+    __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(s, priority), priority);
+    __m128i show_bg = _mm_or_si128(sprite_clear, _mm_andnot_si128(bg_clear, behind));
+
+    __m128i bg_entry = _mm_shuffle_epi8(bg_palette, _mm_and_si128(b, index));
+    __m128i sprite_entry = _mm_shuffle_epi8(sprite_palette, _mm_and_si128(s, index));
+    __m128i entry = _mm_or_si128(_mm_and_si128(show_bg, bg_entry), _mm_andnot_si128(show_bg, sprite_entry));
+    _mm_storeu_si128((__m128i *)(out + x), _mm_and_si128(entry, mask));
+
+    __m128i hits = _mm_andnot_si128(bg_clear, _mm_cmpeq_epi8(_mm_and_si128(s, sprite0), sprite0));
+    unsigned bits = _mm_movemask_epi8(hits);
+    if (x == COMPOSE_WIDTH - 16) {
+      bits &= 0x7FFF;
+    }
+    if (bits && hit < 0) {
+      hit = x + __builtin_ctz(bits);
+    }
+  }
+
+  return hit;
+}
+
+__attribute__((target("avx2")))
+static int compose_line_avx2(uint8_t * out, const uint8_t * bg, const uint8_t * sprites, const uint8_t * palette, int flags) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i color = _mm256_set1_epi8(0x03);
+  const __m256i index = _mm256_set1_epi8(0x0F);
+  const __m256i priority = _mm256_set1_epi8(0x20);
+  const __m256i sprite0 = _mm256_set1_epi8(0x40);
+  const __m256i mask = _mm256_set1_epi8((flags & COMPOSE_GRAYSCALE) ? 0x30 : 0x3F);
+
+  // Shuffles stay within each 128 bit lane, so both lanes get the palette
+  const __m256i bg_palette = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)palette));
+  const __m256i sprite_palette = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(palette + 16)));
+  const __m256i bg_left = _mm256_inserti128_si256(_mm256_set1_epi8(-1), _mm_loadu_si128((const __m128i *)compose_left[(flags & COMPOSE_BG_LEFT) != 0]), 0);
+  const __m256i sprites_left = _mm256_inserti128_si256(_mm256_set1_epi8(-1), _mm_loadu_si128((const __m128i *)compose_left[(flags & COMPOSE_SPRITES_LEFT) != 0]), 0);
+  int hit = -1;
+
+  for (int x = 0; x < COMPOSE_WIDTH; x += 32) {
+    __m256i b = _mm256_loadu_si256((const __m256i *)(bg + x));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(sprites + x));
+    if (x == 0) {
+      b = _mm256_and_si256(b, bg_left);
+      s = _mm256_and_si256(s, sprites_left);
+    }
+
+    __m256i bg_clear = _mm256_cmpeq_epi8(_mm256_and_si256(b, color), zero);
+    __m256i sprite_clear = _mm256_cmpeq_epi8(_mm256_and_si256(s, color), zero);
+    __m256i behind = _mm256_cmpeq_epi8(_mm256_and_si256(s, priority), priority);
+    __m256i show_bg = _mm256_or_si256(sprite_clear, _mm256_andnot_si256(bg_clear, behind));
+
+    __m256i bg_entry = _mm256_shuffle_epi8(bg_palette, _mm256_and_si256(b, index));
+    __m256i sprite_entry = _mm256_shuffle_epi8(sprite_palette, _mm256_and_si256(s, index));
+    __m256i entry = _mm256_blendv_epi8(sprite_entry, bg_entry, show_bg);
+    _mm256_storeu_si256((__m256i *)(out + x), _mm256_and_si256(entry, mask));
+
+    __m256i hits = _mm256_andnot_si256(bg_clear, _mm256_cmpeq_epi8(_mm256_and_si256(s, sprite0), sprite0));
+    unsigned bits = _mm256_movemask_epi8(hits);
+    if (x == COMPOSE_WIDTH - 32) {
+      bits &= 0x7FFFFFFF;
+    }
+    if (bits && hit < 0) {
+      hit = x + __builtin_ctz(bits);
+    }
+  }
+
+  return hit;
+}
+
+#endif
+
+static ComposeLine compose_impl = compose_line_scalar;
+static const char * compose_impl_name = "scalar";
+
+// Pick the widest version the CPU runs
+void compose_init(void) {
+#ifdef COMPOSE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    compose_impl = compose_line_avx2;
+    compose_impl_name = "avx2";
+  } else if (__builtin_cpu_supports("ssse3")) {
+    compose_impl = compose_line_ssse3;
+    compose_impl_name = "ssse3";
+  }
+#endif
+}
+
+const char * compose_name(void) {
+  return compose_impl_name;
+}
+
+/**
+ * Compose COMPOSE_WIDTH pixels into palette entries. The sprite 0 hit
+ * needs both layers opaque, and is never found at the last pixel.
+ */
+int compose_line(uint8_t * out, const uint8_t * bg, const uint8_t * sprites, const uint8_t * palette, int flags) {
+  return compose_impl(out, bg, sprites, palette, flags);
+}
@@ -0,0 +1,33 @@
+#ifndef COMPOSE_H
+#define COMPOSE_H
+
+#include <stdint.h>
+
+/**
+ * Composition of a line's background and sprite pixels into palette
+ * entries, with sprite priority, left column clipping, grayscale and the
+ * sprite 0 hit test.
+ *
+ * Pixels come in as the PPU draws them: the color in the low 2 bits and
+ * the palette in the next 2, so 0 is transparent. Sprite pixels also have
+ * bit 5 set when behind the background, and bit 6 for sprite 0.
+ *
+ * The work is done 32 or 16 pixels at a time where the CPU supports it,
+ * chosen once by compose_init.
+ */
+
+enum {
+  COMPOSE_BG_LEFT      = 1 << 0, // Background in the leftmost 8 pixels
+  COMPOSE_SPRITES_LEFT = 1 << 1, // Sprites in the leftmost 8 pixels
+  COMPOSE_GRAYSCALE    = 1 << 2,
+};
+
+#define COMPOSE_WIDTH 256
+
+void compose_init(void);
+const char * compose_name(void);
+
+// Returns the first x with a sprite 0 hit, or -1
+int compose_line(uint8_t * out, const uint8_t * bg, const uint8_t * sprites, const uint8_t * palette, int flags);
+
+#endif
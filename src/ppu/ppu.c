@@ -0,0 +1,822 @@
+#include <string.h>
+
+#include "ppu.h"
+#include "compose.h"
+#include "mapper/mapper.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#include "nes.h"
+
+// Note: This assumes that the PPU can only exist within a NES.
+// Maybe this coupling is too strong...
+static NES * ppu_nes(PPU * ppu) {
+  return (NES *)((char *)ppu - offsetof(struct NES, ppu));
+}
+
+// What is switched into the PPU address space, NULL without a cartridge
+static const MapperBanks * ppu_banks(PPU * ppu) {
+  Cartridge * cartridge = ppu_nes(ppu)->cartridge;
+  return cartridge ? cartridge_banks(cartridge) : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Things the PPU does at a given dot of a scanline. Everything else it
+ * does is either invisible to the CPU, or done by ppu_render_line.
+ */
+enum {
+  PPU_RENDER    = 1 << 0, // Draw a visible line
+  PPU_VBLANK    = 1 << 1, // Vertical blank starts
+  PPU_PRERENDER = 1 << 2, // Flags are cleared for the next frame
+  PPU_SCANLINE  = 1 << 3, // The mapper sees the line's sprite fetches
+  PPU_RELOAD    = 1 << 4, // The vertical scroll is copied from t to v
+
+  // Those the CPU has to stop for, see ppu_next_event
+  PPU_EVENTS = PPU_VBLANK | PPU_SCANLINE
+};
+
+static const int ppu_action_dots[] = {1, 260, 280};
+
+void ppu_init(PPU * ppu) {
+  compose_init();
+  ppu->mode = PPU_MODE_SCANLINE;
+  ppu_reset(ppu);
+}
+
+void ppu_reset(PPU * ppu) {
+  PPUMode mode = ppu->mode;
+  memset(ppu, 0, sizeof(PPU));
+  ppu->mode = mode;
+  ppu->sprite0_dot = -1;
+  ppu->lines.dirty = true;
+}
+
+static bool ppu_rendering(PPU * ppu) {
+  return ppu->mask.bg || ppu->mask.sprites;
+}
+
+// The pre-render line is a dot shorter on odd frames while rendering
+static int ppu_frame_dots(PPU * ppu) {
+  int dots = PPU_SCANLINES * PPU_DOTS;
+  if ((ppu->frame & 1) && ppu_rendering(ppu)) {
+    dots--;
+  }
+  return dots;
+}
+
+static int ppu_actions(PPU * ppu, int line, int dot) {
+  bool rendering = ppu_rendering(ppu);
+
+  switch (dot) {
+  case 1:
+    if (line < PPU_HEIGHT) return PPU_RENDER;
+    if (line == PPU_VBLANK_LINE) return PPU_VBLANK;
+    if (line == PPU_PRERENDER_LINE) return PPU_PRERENDER;
+    break;
+  case 260:
+    if (rendering && (line < PPU_HEIGHT || line == PPU_PRERENDER_LINE)) return PPU_SCANLINE;
+    break;
+  case 280:
+    if (rendering && line == PPU_PRERENDER_LINE) return PPU_RELOAD;
+    break;
+  }
+
+  return 0;
+}
+
+/**
+ * First dot from the given one on where any of the wanted actions happen.
+ * Returns the end of the frame with no actions if there are none left.
+ */
+static int ppu_next_action(PPU * ppu, int from, int wanted, int * actions) {
+  int end = ppu_frame_dots(ppu);
+
+  for (int line = from / PPU_DOTS; line < PPU_SCANLINES; ++line) {
+    for (size_t i = 0; i < sizeof(ppu_action_dots) / sizeof(*ppu_action_dots); ++i) {
+      int dot = line * PPU_DOTS + ppu_action_dots[i];
+      if (dot >= from && dot < end) {
+        *actions = ppu_actions(ppu, line, ppu_action_dots[i]) & wanted;
+        if (*actions) {
+          return dot;
+        }
+      }
+    }
+  }
+
+  *actions = 0;
+  return from > end ? from : end;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t ppu_chr_read(const MapperBanks * banks, uint16_t addr) {
+  const uint8_t * window = banks ? banks->chr[addr / MAPPER_CHR_WINDOW_SIZE] : NULL;
+  return window ? window[addr % MAPPER_CHR_WINDOW_SIZE] : 0;
+}
+
+// Pixels of a row of a tile, from the cartridge's decoded CHR when it has them
+static void ppu_tile_row(PPU * ppu, const MapperBanks * banks, uint16_t addr, uint8_t * pixels) {
+  const uint8_t * window = banks ? banks->chr[addr / MAPPER_CHR_WINDOW_SIZE] : NULL;
+  const uint8_t * decoded = window ? cartridge_chr_pixels(ppu_nes(ppu)->cartridge, window) : NULL;
+
+  if (decoded) {
+    memcpy(pixels, decoded + ((addr & 0x03F0) << 2 | (addr & 7) << 3), 8);
+    return;
+  }
+
+  uint8_t lo = ppu_chr_read(banks, addr);
+  uint8_t hi = ppu_chr_read(banks, addr + 8);
+  for (int x = 0; x < 8; ++x) {
+    pixels[x] = (lo >> (7 - x) & 1) | (hi >> (7 - x) & 1) << 1;
+  }
+}
+
+// Nametable byte behind $2000-$3EFF, after the cartridge's mirroring
+static uint8_t * ppu_nametable(PPU * ppu, const MapperBanks * banks, uint16_t addr) {
+  Mirror mirror = banks ? banks->mirror : MIRROR_HORIZONTAL;
+  uint16_t offset = addr & 0x0FFF;
+
+  switch (mirror) {
+  case MIRROR_HORIZONTAL:
+    offset = (offset >> 1 & 0x0400) | (offset & 0x03FF);
+    break;
+  case MIRROR_VERTICAL:
+    offset &= 0x07FF;
+    break;
+  case MIRROR_QUAD:
+    break;
+  case MIRROR_SINGLE_LOWER:
+    offset &= 0x03FF;
+    break;
+  case MIRROR_SINGLE_UPPER:
+    offset = 0x0400 | (offset & 0x03FF);
+    break;
+  }
+
+  return &ppu->vram[offset];
+}
+
+// $3F10, $3F14, $3F18 and $3F1C are the same entries as $3F00-$3F0C
+static uint8_t * ppu_palette(PPU * ppu, uint16_t addr) {
+  addr &= 0x1F;
+  if ((addr & 0x13) == 0x10) {
+    addr &= ~0x10;
+  }
+  return &ppu->palette[addr];
+}
+
+static uint8_t ppu_memory_read(PPU * ppu, uint16_t addr) {
+  const MapperBanks * banks = ppu_banks(ppu);
+  addr &= 0x3FFF;
+
+  if (addr < 0x2000) {
+    return ppu_chr_read(banks, addr);
+  } else if (addr < 0x3F00) {
+    return *ppu_nametable(ppu, banks, addr);
+  } else {
+    return *ppu_palette(ppu, addr);
+  }
+}
+
+static void ppu_memory_write(PPU * ppu, uint16_t addr, uint8_t val) {
+  Cartridge * cartridge = ppu_nes(ppu)->cartridge;
+  const MapperBanks * banks = ppu_banks(ppu);
+  addr &= 0x3FFF;
+
+  if (addr < 0x2000) {
+    uint8_t * window = banks ? banks->chr[addr / MAPPER_CHR_WINDOW_SIZE] : NULL;
+    if (window && cartridge->chr_ram) {
+      cartridge_chr_write(cartridge, &window[addr % MAPPER_CHR_WINDOW_SIZE], val);
+    }
+  } else if (addr < 0x3F00) {
+    *ppu_nametable(ppu, banks, addr) = val;
+  } else {
+    *ppu_palette(ppu, addr) = val & 0x3F;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void ppu_increment_x(uint16_t * v) {
+  if ((*v & 0x001F) == 31) {
+    *v &= ~0x001F;
+    *v ^= 0x0400;
+  } else {
+    *v += 1;
+  }
+}
+
+static void ppu_increment_y(PPU * ppu) {
+  uint16_t v = ppu->v;
+
+  if ((v & 0x7000) != 0x7000) {
+    v += 0x1000;
+  } else {
+    v &= ~0x7000;
+    int y = (v & 0x03E0) >> 5;
+    if (y == 29) {
+      y = 0;
+      v ^= 0x0800;
+    } else if (y == 31) {
+      y = 0;
+    } else {
+      y++;
+    }
+    v = (v & ~0x03E0) | (y << 5);
+  }
+
+  ppu->v = v;
+}
+
+/**
+ * Background pixels of a line, starting fine X pixels into the buffer.
+ * Each is its color in the low 2 bits and palette in the next 2, so
+ * 0 is transparent.
+ */
+static void ppu_render_bg(PPU * ppu, const MapperBanks * banks, uint8_t * bg) {
+  uint16_t v = ppu->v;
+  uint16_t table = ppu->ctrl.bg_table ? 0x1000 : 0x0000;
+
+  for (int tile = 0; tile < PPU_WIDTH / 8 + 1; ++tile) {
+    uint8_t id = *ppu_nametable(ppu, banks, 0x2000 | (v & 0x0FFF));
+    uint8_t attr = *ppu_nametable(ppu, banks, 0x23C0 | (v & 0x0C00) | (v >> 4 & 0x38) | (v >> 2 & 0x07));
+    uint8_t palette = (attr >> ((v >> 4 & 4) | (v & 2)) & 3) << 2;
+
+    uint8_t * pixels = &bg[tile * 8];
+    ppu_tile_row(ppu, banks, table | id << 4 | v >> 12, pixels);
+    for (int i = 0; i < 8; ++i) {
+      if (pixels[i]) {
+        pixels[i] |= palette;
+      }
+    }
+
+    ppu_increment_x(&v);
+  }
+}
+
+// Whether a byte of OAM, read as a Y coordinate, is on a line
+static bool ppu_on_line(PPU * ppu, uint8_t y, int line) {
+  int row = line - y - 1;
+  return row >= 0 && row < (ppu->ctrl.sprite_size ? 16 : 8);
+}
+
+/**
+ * Find the sprites on every line at once, the first eight of each in OAM
+ * order. Each sprite is only added to the lines it covers, so this costs
+ * far less than scanning OAM for every line, and as long as OAM is left
+ * alone it isn't done again.
+ *
+ * The overflow flag follows the PPU's evaluation bug: after the eighth
+ * sprite it keeps looking at the following ones, but also steps through
+ * their bytes, so it takes tiles, attributes and X for Y coordinates.
+ */
+static void ppu_sort_oam(PPU * ppu) {
+  int height = ppu->ctrl.sprite_size ? 16 : 8;
+
+  memset(ppu->lines.count, 0, sizeof(ppu->lines.count));
+  memset(ppu->lines.overflow, 0, sizeof(ppu->lines.overflow));
+
+  for (int i = 0; i < 64; ++i) {
+    int top = ppu->oam[i * 4] + 1;
+    for (int line = top; line < top + height && line <= PPU_HEIGHT; ++line) {
+      if (ppu->lines.count[line] < 8) {
+        ppu->lines.index[line][ppu->lines.count[line]++] = i;
+      }
+    }
+  }
+
+  for (int line = 0; line <= PPU_HEIGHT; ++line) {
+    if (ppu->lines.count[line] < 8) {
+      continue;
+    }
+
+    int m = 0;
+    for (int n = ppu->lines.index[line][7] + 1; n < 64; ++n) {
+      if (ppu_on_line(ppu, ppu->oam[n * 4 + m], line)) {
+        ppu->lines.overflow[line] = true;
+        break;
+      }
+      m = (m + 1) & 3;
+    }
+  }
+
+  ppu->lines.dirty = false;
+}
+
+// Fetch the patterns of the sprites on a line, and flag an overflow
+static void ppu_evaluate_sprites(PPU * ppu, const MapperBanks * banks, int line) {
+  int height = ppu->ctrl.sprite_size ? 16 : 8;
+
+  if (ppu->lines.dirty) {
+    ppu_sort_oam(ppu);
+  }
+
+  if (ppu->lines.overflow[line]) {
+    ppu->status.overflow = true;
+  }
+
+  int count = ppu->lines.count[line];
+  for (int i = 0; i < count; ++i) {
+    int index = ppu->lines.index[line][i];
+    const uint8_t * sprite = &ppu->oam[index * 4];
+
+    // Sprites are drawn a line below their Y
+    int row = line - sprite[0] - 1;
+    uint8_t tile = sprite[1];
+    uint8_t attr = sprite[2];
+    if (attr & 0x80) {
+      row = height - 1 - row;
+    }
+
+    uint16_t addr;
+    if (height == 16) {
+      addr = (tile & 1) << 12 | (tile & 0xFE) << 4 | (row & 8) << 1 | (row & 7);
+    } else {
+      addr = (ppu->ctrl.sprite_table ? 0x1000 : 0x0000) | tile << 4 | row;
+    }
+
+    ppu->sprites.x[i] = sprite[3];
+    ppu->sprites.attr[i] = attr;
+    ppu_tile_row(ppu, banks, addr, ppu->sprites.pixels[i]);
+  }
+
+  ppu->sprites.count = count;
+  ppu->sprites.zero = count > 0 && ppu->lines.index[line][0] == 0;
+}
+
+/**
+ * Sprite pixel of one of the evaluated sprites, encoded like the
+ * background with bit 5 set when behind it and bit 6 for sprite 0
+ */
+static uint8_t ppu_sprite_pixel(PPU * ppu, int i, int px) {
+  uint8_t attr = ppu->sprites.attr[i];
+  uint8_t color = ppu->sprites.pixels[i][(attr & 0x40) ? 7 - px : px];
+  if (!color) {
+    return 0;
+  }
+  return color | (attr & 3) << 2 | (attr & 0x20) | (i == 0 && ppu->sprites.zero ? 0x40 : 0);
+}
+
+// Evaluate and draw the sprites on a line, lower OAM entries over higher ones
+static void ppu_render_sprites(PPU * ppu, const MapperBanks * banks, int line, uint8_t * sprites) {
+  ppu_evaluate_sprites(ppu, banks, line);
+
+  for (int i = 0; i < ppu->sprites.count; ++i) {
+    int x = ppu->sprites.x[i];
+    for (int px = 0; px < 8 && x + px < PPU_WIDTH; ++px) {
+      uint8_t * out = &sprites[x + px];
+      if (!(*out & 3)) {
+        *out = ppu_sprite_pixel(ppu, i, px);
+      }
+    }
+  }
+}
+
+// Palette entry for a background and a sprite pixel, by sprite priority
+static uint8_t ppu_mux(PPU * ppu, uint8_t b, uint8_t s) {
+  uint8_t index = 0;
+  if ((s & 3) && (!(s & 0x20) || !(b & 3))) {
+    index = 0x10 | (s & 0x0F);
+  } else if (b & 3) {
+    index = b & 0x0F;
+  }
+  return ppu->palette[index] & (ppu->mask.grayscale ? 0x30 : 0x3F);
+}
+
+/**
+ * Draw a whole visible line into the framebuffer, as palette indices.
+ * Registers are taken as they were at the start of the line, so writes
+ * made while it is being drawn only show from the next one on.
+ */
+static void ppu_render_line(PPU * ppu, int line) {
+  NES * nes = ppu_nes(ppu);
+  uint8_t * out = nes->framebuffer[ppu->frame & 1][line];
+  nes->emphasis[ppu->frame & 1][line] = ppu->mask.emphasis;
+
+  if (!ppu_rendering(ppu)) {
+    memset(out, ppu_mux(ppu, 0, 0), PPU_WIDTH);
+    return;
+  }
+
+  const MapperBanks * banks = ppu_banks(ppu);
+  uint8_t bg[PPU_WIDTH + 8] = {0};
+  uint8_t sprites[PPU_WIDTH] = {0};
+
+  // The horizontal scroll is reloaded at the end of the previous line
+  ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+
+  if (ppu->mask.bg) {
+    ppu_render_bg(ppu, banks, bg);
+  }
+
+  ppu_render_sprites(ppu, banks, line, sprites);
+  if (!ppu->mask.sprites) {
+    memset(sprites, 0, PPU_WIDTH);
+  }
+
+  int flags = 0;
+  flags |= ppu->mask.bg_left ? COMPOSE_BG_LEFT : 0;
+  flags |= ppu->mask.sprites_left ? COMPOSE_SPRITES_LEFT : 0;
+  flags |= ppu->mask.grayscale ? COMPOSE_GRAYSCALE : 0;
+
+  int hit = compose_line(out, bg + ppu->x, sprites, ppu->palette, flags);
+  if (hit >= 0 && ppu->sprite0_dot < 0) {
+    ppu->sprite0_dot = line * PPU_DOTS + hit + 1;
+  }
+
+  ppu_increment_y(ppu);
+}
+
+static void ppu_act(PPU * ppu, int actions) {
+  int line = ppu->dot / PPU_DOTS;
+
+  if (actions & PPU_RENDER) {
+    ppu_render_line(ppu, line);
+  }
+
+  if (actions & PPU_VBLANK) {
+    ppu->status.vblank = true;
+    ppu->frame++;
+    if (ppu->ctrl.nmi) {
+      cpu_nmi(&ppu_nes(ppu)->cpu);
+    }
+  }
+
+  if (actions & PPU_PRERENDER) {
+    ppu->status.vblank = false;
+    ppu->status.sprite0 = false;
+    ppu->status.overflow = false;
+    ppu->sprite0_dot = -1;
+  }
+
+  if (actions & PPU_SCANLINE) {
+    Cartridge * cartridge = ppu_nes(ppu)->cartridge;
+    if (cartridge) {
+      cartridge_scanline(cartridge);
+    }
+  }
+
+  if (actions & PPU_RELOAD) {
+    ppu->v = (ppu->v & 0x041F) | (ppu->t & 0x7BE0);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Lines that fetch in dot mode, the pre-render line only while rendering
+static bool ppu_fetching(PPU * ppu) {
+  int line = ppu->dot / PPU_DOTS;
+  return line < PPU_HEIGHT || (line == PPU_PRERENDER_LINE && ppu_rendering(ppu));
+}
+
+// Move the background tile fetched last into the low byte of the shifters
+static void ppu_reload_bg(PPU * ppu) {
+  ppu->bg.pattern[0] = (ppu->bg.pattern[0] & 0xFF00) | ppu->bg.lo;
+  ppu->bg.pattern[1] = (ppu->bg.pattern[1] & 0xFF00) | ppu->bg.hi;
+  ppu->bg.palette[0] = (ppu->bg.palette[0] & 0xFF00) | (ppu->bg.attr & 1 ? 0xFF : 0x00);
+  ppu->bg.palette[1] = (ppu->bg.palette[1] & 0xFF00) | (ppu->bg.attr & 2 ? 0xFF : 0x00);
+}
+
+/**
+ * What rendering does at a dot: the background is fetched a tile every
+ * eight dots and shifted out a pixel a dot, 2 tiles ahead of the one
+ * drawn. Sprites are evaluated at once for the next line when the
+ * background fetches stop.
+ */
+static void ppu_fetch(PPU * ppu, int line, int x) {
+  const MapperBanks * banks = ppu_banks(ppu);
+
+  if ((x >= 1 && x <= 256) || (x >= 321 && x <= 336)) {
+    ppu->bg.pattern[0] <<= 1;
+    ppu->bg.pattern[1] <<= 1;
+    ppu->bg.palette[0] <<= 1;
+    ppu->bg.palette[1] <<= 1;
+
+    uint16_t v = ppu->v;
+    uint16_t table = ppu->ctrl.bg_table ? 0x1000 : 0x0000;
+
+    switch ((x - 1) & 7) {
+    case 1:
+      ppu->bg.id = *ppu_nametable(ppu, banks, 0x2000 | (v & 0x0FFF));
+      break;
+    case 3: {
+      uint8_t attr = *ppu_nametable(ppu, banks, 0x23C0 | (v & 0x0C00) | (v >> 4 & 0x38) | (v >> 2 & 0x07));
+      ppu->bg.attr = attr >> ((v >> 4 & 4) | (v & 2)) & 3;
+      break;
+    }
+    case 5:
+      ppu->bg.lo = ppu_chr_read(banks, table | ppu->bg.id << 4 | v >> 12);
+      break;
+    case 7:
+      ppu->bg.hi = ppu_chr_read(banks, (table | ppu->bg.id << 4 | v >> 12) + 8);
+      ppu_reload_bg(ppu);
+      ppu_increment_x(&v);
+      ppu->v = v;
+      break;
+    }
+  }
+
+  if (x == 256) {
+    ppu_increment_y(ppu);
+  }
+
+  if (x == 257) {
+    ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+    if (line < PPU_HEIGHT) {
+      ppu_evaluate_sprites(ppu, banks, line + 1);
+    } else {
+      // Nothing is evaluated for the first line
+      ppu->sprites.count = 0;
+      ppu->sprites.zero = false;
+    }
+  }
+
+  if (line == PPU_PRERENDER_LINE && x >= 280 && x <= 304) {
+    ppu->v = (ppu->v & 0x041F) | (ppu->t & 0x7BE0);
+  }
+}
+
+// Draw the pixel at a dot of a visible line, from the registers as they are now.
+// Emphasis only goes by line, the last pixel drawn sets it.
+static void ppu_output(PPU * ppu, int line, int x) {
+  NES * nes = ppu_nes(ppu);
+  uint8_t * out = &nes->framebuffer[ppu->frame & 1][line][x];
+  nes->emphasis[ppu->frame & 1][line] = ppu->mask.emphasis;
+
+  if (!ppu_rendering(ppu)) {
+    *out = ppu_mux(ppu, 0, 0);
+    return;
+  }
+
+  uint8_t b = 0;
+  if (ppu->mask.bg && (x >= 8 || ppu->mask.bg_left)) {
+    int bit = 15 - ppu->x;
+    uint8_t color = (ppu->bg.pattern[0] >> bit & 1) | (ppu->bg.pattern[1] >> bit & 1) << 1;
+    uint8_t palette = (ppu->bg.palette[0] >> bit & 1) | (ppu->bg.palette[1] >> bit & 1) << 1;
+    b = color ? color | palette << 2 : 0;
+  }
+
+  uint8_t s = 0;
+  if (ppu->mask.sprites && (x >= 8 || ppu->mask.sprites_left)) {
+    for (int i = 0; i < ppu->sprites.count && !s; ++i) {
+      int px = x - ppu->sprites.x[i];
+      if (px >= 0 && px < 8) {
+        s = ppu_sprite_pixel(ppu, i, px);
+      }
+    }
+  }
+
+  *out = ppu_mux(ppu, b, s);
+
+  if ((s & 0x40) && (b & 3) && x != PPU_WIDTH - 1) {
+    ppu->status.sprite0 = true;
+  }
+}
+
+// Run a single dot of a line that fetches
+static void ppu_step(PPU * ppu) {
+  int line = ppu->dot / PPU_DOTS;
+  int x = ppu->dot % PPU_DOTS;
+
+  if (line < PPU_HEIGHT && x >= 1 && x <= PPU_WIDTH) {
+    ppu_output(ppu, line, x - 1);
+  }
+
+  if (ppu_rendering(ppu)) {
+    ppu_fetch(ppu, line, x);
+  }
+
+  // Drawing and the scroll copies are done above
+  int actions = ppu_actions(ppu, line, x) & ~(PPU_RENDER | PPU_RELOAD);
+  if (actions) {
+    ppu_act(ppu, actions);
+  }
+
+  if (++ppu->dot >= ppu_frame_dots(ppu)) {
+    ppu->dot = 0;
+  }
+}
+
+/**
+ * Dot mode: step through every dot of the lines that fetch, and skip
+ * over the rest from one action to the next like the scanline mode
+ */
+static void ppu_run_dots(PPU * ppu, int dots) {
+  while (dots > 0) {
+    if (ppu_fetching(ppu)) {
+      ppu_step(ppu);
+      dots--;
+      continue;
+    }
+
+    int actions;
+    int next = ppu_next_action(ppu, ppu->dot, ~(PPU_RENDER | PPU_RELOAD), &actions);
+
+    // Stop where fetching starts again
+    int line = ppu->dot / PPU_DOTS;
+    int end = ppu_frame_dots(ppu);
+    if (ppu_rendering(ppu) && line < PPU_PRERENDER_LINE) {
+      end = PPU_PRERENDER_LINE * PPU_DOTS;
+    }
+    if (next >= end) {
+      next = end;
+      actions = 0;
+    }
+
+    if (next - ppu->dot >= dots) {
+      ppu->dot += dots;
+      return;
+    }
+
+    dots -= next - ppu->dot;
+    ppu->dot = next;
+    if (ppu->dot >= ppu_frame_dots(ppu)) {
+      ppu->dot = 0;
+    } else if (actions) {
+      ppu_act(ppu, actions);
+      ppu->dot++;
+      dots--;
+    }
+  }
+}
+
+/**
+ * Catch the PPU up to a CPU cycle, three dots to each. In scanline mode,
+ * rather than stepping through dots it skips straight to the few that do
+ * anything, drawing a visible line at once when reaching it.
+ */
+void ppu_run_until(PPU * ppu, int clock) {
+  int dots = 3 * (clock - ppu->clock);
+  if (dots <= 0) {
+    return;
+  }
+  ppu->clock = clock;
+
+  if (ppu->mode == PPU_MODE_DOT) {
+    ppu_run_dots(ppu, dots);
+    return;
+  }
+
+  while (true) {
+    int actions;
+    int next = ppu_next_action(ppu, ppu->dot, ~0, &actions);
+    if (next - ppu->dot >= dots && (actions || next - ppu->dot > dots)) {
+      ppu->dot += dots;
+      return;
+    }
+
+    dots -= next - ppu->dot;
+    if (!actions) {
+      // End of the frame
+      ppu->dot = 0;
+      continue;
+    }
+
+    ppu->dot = next;
+    ppu_act(ppu, actions);
+    ppu->dot++;
+    dots--;
+  }
+}
+
+/**
+ * CPU cycle at which the PPU next has to be run for the CPU to notice:
+ * the start of vertical blank for the NMI, and while rendering, each
+ * scanline if the mapper counts them
+ */
+int ppu_next_event(PPU * ppu) {
+  Cartridge * cartridge = ppu_nes(ppu)->cartridge;
+  int wanted = PPU_EVENTS;
+  if (!cartridge || !cartridge_has_scanline(cartridge)) {
+    wanted &= ~PPU_SCANLINE;
+  }
+
+  int actions;
+  int next = ppu_next_action(ppu, ppu->dot, wanted, &actions);
+  int dots = next - ppu->dot;
+
+  // There is a vertical blank in every frame
+  if (!actions) {
+    dots += ppu_next_action(ppu, 0, wanted, &actions);
+  }
+
+  // The dot runs once the PPU is past it
+  return ppu->clock + (dots + 3) / 3;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void ppu_write(PPU * ppu, PPUAddress addr, uint8_t val) {
+  switch (addr) {
+  case PPU_CTRL: {
+    bool nmi = ppu->ctrl.nmi;
+    bool sprite_size = ppu->ctrl.sprite_size;
+    ppu->ctrl.increment = (val >> 2) & 1;
+    ppu->ctrl.sprite_table = (val >> 3) & 1;
+    ppu->ctrl.bg_table = (val >> 4) & 1;
+    ppu->ctrl.sprite_size = (val >> 5) & 1;
+    ppu->ctrl.nmi = (val >> 7) & 1;
+    ppu->t = (ppu->t & ~0x0C00) | (val & 3) << 10;
+
+    if (ppu->ctrl.sprite_size != sprite_size) {
+      ppu->lines.dirty = true;
+    }
+
+    // Enabling the NMI during vertical blank raises it right away
+    if (!nmi && ppu->ctrl.nmi && ppu->status.vblank) {
+      cpu_nmi(&ppu_nes(ppu)->cpu);
+    }
+    break;
+  }
+  case PPU_MASK:
+    ppu->mask.grayscale = (val >> 0) & 1;
+    ppu->mask.bg_left = (val >> 1) & 1;
+    ppu->mask.sprites_left = (val >> 2) & 1;
+    ppu->mask.bg = (val >> 3) & 1;
+    ppu->mask.sprites = (val >> 4) & 1;
+    ppu->mask.emphasis = (val >> 5) & 7;
+    break;
+  case PPU_STATUS:
+    break;
+  case PPU_OAM_ADDR:
+    ppu->oam_addr = val;
+    break;
+  case PPU_OAM_DATA:
+    ppu->oam[ppu->oam_addr++] = val;
+    ppu->lines.dirty = true;
+    break;
+  case PPU_SCROLL:
+    if (!ppu->w) {
+      ppu->t = (ppu->t & ~0x001F) | val >> 3;
+      ppu->x = val & 7;
+    } else {
+      ppu->t = (ppu->t & ~0x73E0) | (val & 7) << 12 | (val & 0xF8) << 2;
+    }
+    ppu->w = !ppu->w;
+    break;
+  case PPU_ADDR:
+    if (!ppu->w) {
+      ppu->t = (ppu->t & 0x00FF) | (val & 0x3F) << 8;
+    } else {
+      ppu->t = (ppu->t & 0xFF00) | val;
+      ppu->v = ppu->t;
+    }
+    ppu->w = !ppu->w;
+    break;
+  case PPU_DATA:
+    ppu_memory_write(ppu, ppu->v, val);
+    ppu->v += ppu->ctrl.increment ? 32 : 1;
+    break;
+  default:
+    break;
+  }
+}
+
+uint8_t ppu_read(PPU * ppu, PPUAddress addr) {
+  uint8_t val = 0;
+
+  switch (addr) {
+  case PPU_STATUS:
+    // The hit was drawn with its line, but only happens at its dot
+    if (ppu->sprite0_dot >= 0 && ppu->dot > ppu->sprite0_dot) {
+      ppu->status.sprite0 = true;
+    }
+
+    val |= (ppu->status.vblank & 1) << 7;
+    val |= (ppu->status.sprite0 & 1) << 6;
+    val |= (ppu->status.overflow & 1) << 5;
+
+    ppu->status.vblank = false;
+    ppu->w = false;
+    break;
+  case PPU_OAM_DATA:
+    val = ppu->oam[ppu->oam_addr];
+    break;
+  case PPU_DATA:
+    // The palette is read directly, but the nametable under it still
+    // goes to the buffer
+    if ((ppu->v & 0x3FFF) >= 0x3F00) {
+      val = ppu_memory_read(ppu, ppu->v);
+      ppu->read_buffer = ppu_memory_read(ppu, ppu->v - 0x1000);
+    } else {
+      val = ppu->read_buffer;
+      ppu->read_buffer = ppu_memory_read(ppu, ppu->v);
+    }
+    ppu->v += ppu->ctrl.increment ? 32 : 1;
+    break;
+  default:
+    break;
+  }
+
+  return val;
+}
+
+// $4014 copies a page of CPU memory into OAM, starting at OAMADDR
+void ppu_oam_dma(PPU * ppu, const uint8_t * data) {
+  for (int i = 0; i < 256; ++i) {
+    ppu->oam[(ppu->oam_addr + i) & 0xFF] = data[i];
+  }
+  ppu->lines.dirty = true;
+}
@@ -0,0 +1,121 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * References:
+ * PPU: http://wiki.nesdev.com/w/index.php/PPU
+ * Registers: http://wiki.nesdev.com/w/index.php/PPU_registers
+ * Rendering: http://wiki.nesdev.com/w/index.php/PPU_rendering
+ * Scrolling: http://wiki.nesdev.com/w/index.php/PPU_scrolling
+ */
+
+#define PPU_WIDTH 256
+#define PPU_HEIGHT 240
+
+#define PPU_DOTS 341      // Per scanline
+#define PPU_SCANLINES 262 // Per frame, NTSC
+#define PPU_VBLANK_LINE 241
+#define PPU_PRERENDER_LINE 261
+
+typedef enum {
+  PPU_MODE_SCANLINE, // Visible lines drawn whole at their first dot
+  PPU_MODE_DOT,      // Every dot of the fetch and shift pipeline, see ppu_step
+} PPUMode;
+
+typedef struct PPU PPU;
+struct PPU {
+  PPUMode mode; // Kept across resets
+
+  struct {
+    bool increment    : 1; // Step $2007 by 32 instead of 1
+    bool sprite_table : 1; // 8x8 sprites at $1000
+    bool bg_table     : 1; // Background at $1000
+    bool sprite_size  : 1; // 8x16 sprites
+    bool nmi          : 1; // NMI at the start of vertical blank
+  } ctrl;
+
+  struct {
+    bool grayscale    : 1;
+    bool bg_left      : 1; // Background in the leftmost 8 pixels
+    bool sprites_left : 1; // Sprites in the leftmost 8 pixels
+    bool bg           : 1;
+    bool sprites      : 1;
+    uint8_t emphasis  : 3; // Red, green and blue in bits 0 to 2
+  } mask;
+
+  struct {
+    bool overflow : 1;
+    bool sprite0  : 1;
+    bool vblank   : 1;
+  } status;
+
+  uint8_t oam_addr;
+
+  // Internal variables
+  uint16_t v : 15;      // VRAM address, and the scroll while rendering
+  uint16_t t : 15;      // Address or scroll being written
+  uint8_t x : 3;        // Fine X scroll
+  bool w : 1;           // Second write to $2005 and $2006
+  uint8_t read_buffer;  // $2007 reads below the palette lag by one
+
+  uint8_t oam[256];
+  uint8_t palette[32];
+  uint8_t vram[0x1000]; // Nametables, the upper half is only used with MIRROR_QUAD
+
+  int clock;       // CPU cycle the PPU has been run up to
+  int dot;         // Next dot to run, counted from the start of the frame
+  int frame;       // Frames completed, the framebuffer drawn into is frame & 1
+  int sprite0_dot; // Dot of the sprite 0 hit on the lines drawn so far, -1 if none
+
+  // Dot mode only: the background tiles being shifted out, the current
+  // one in the upper byte and the next in the lower
+  struct {
+    uint8_t id, attr, lo, hi; // Fetched for the next reload
+    uint16_t pattern[2];
+    uint16_t palette[2];
+  } bg;
+
+  // Sprites found on the line being drawn, in OAM order
+  struct {
+    int count;
+    bool zero; // The first one is sprite 0
+    uint8_t x[8], attr[8];
+    uint8_t pixels[8][8]; // Colors of their row, unflipped
+  } sprites;
+
+  // What evaluating each line finds in OAM, up to the one below the
+  // picture. Rebuilt when OAM or the sprite size changes, see ppu_sort_oam.
+  struct {
+    bool dirty;
+    uint8_t count[PPU_HEIGHT + 1];
+    uint8_t index[PPU_HEIGHT + 1][8];
+    bool overflow[PPU_HEIGHT + 1];
+  } lines;
+};
+
+typedef enum {
+  PPU_CTRL,
+  PPU_MASK,
+  PPU_STATUS,
+  PPU_OAM_ADDR,
+  PPU_OAM_DATA,
+  PPU_SCROLL,
+  PPU_ADDR,
+  PPU_DATA,
+
+  PPU_ADDRESS_SIZE
+} PPUAddress;
+
+void ppu_init(PPU * ppu);
+void ppu_reset(PPU * ppu);
+
+void ppu_run_until(PPU * ppu, int clock);
+int ppu_next_event(PPU * ppu);
+void ppu_write(PPU * ppu, PPUAddress addr, uint8_t val);
+uint8_t ppu_read(PPU * ppu, PPUAddress addr);
+void ppu_oam_dma(PPU * ppu, const uint8_t * data);
+
+#endif
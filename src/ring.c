@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+bool ring_init(Ring * ring, unsigned size) {
+  if (size == 0 || (size & (size - 1)) != 0) {
+    return false;
+  }
+
+  ring->buffer = malloc(size * sizeof(float));
+  if (!ring->buffer) {
+    return false;
+  }
+
+  ring->size = size;
+  atomic_init(&ring->write, 0);
+  atomic_init(&ring->read, 0);
+  return true;
+}
+
+void ring_deinit(Ring * ring) {
+  free(ring->buffer);
+  ring->buffer = NULL;
+}
+
+// Copy count samples starting at a free running index, wrapping around
+static void ring_copy_in(Ring * ring, unsigned index, const float * samples, unsigned count) {
+  unsigned start = index & (ring->size - 1);
+  unsigned first = ring->size - start < count ? ring->size - start : count;
+  memcpy(ring->buffer + start, samples, first * sizeof(float));
+  memcpy(ring->buffer, samples + first, (count - first) * sizeof(float));
+}
+
+static void ring_copy_out(Ring * ring, unsigned index, float * samples, unsigned count) {
+  unsigned start = index & (ring->size - 1);
+  unsigned first = ring->size - start < count ? ring->size - start : count;
+  memcpy(samples, ring->buffer + start, first * sizeof(float));
+  memcpy(samples + first, ring->buffer, (count - first) * sizeof(float));
+}
+
+/**
+ * Producer side, returns how many samples fit. The samples are copied in
+ * before the write index is published, so the consumer never sees a slot
+ * that hasn't been filled.
+ */
+unsigned ring_write(Ring * ring, const float * samples, unsigned count) {
+  unsigned write = atomic_load_explicit(&ring->write, memory_order_relaxed);
+  unsigned read = atomic_load_explicit(&ring->read, memory_order_acquire);
+
+  unsigned free = ring->size - (write - read);
+  if (count > free) {
+    count = free;
+  }
+
+  ring_copy_in(ring, write, samples, count);
+  atomic_store_explicit(&ring->write, write + count, memory_order_release);
+  return count;
+}
+
+// Consumer side, returns how many samples there were
+unsigned ring_read(Ring * ring, float * samples, unsigned count) {
+  unsigned read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+  unsigned write = atomic_load_explicit(&ring->write, memory_order_acquire);
+
+  unsigned used = write - read;
+  if (count > used) {
+    count = used;
+  }
+
+  ring_copy_out(ring, read, samples, count);
+  atomic_store_explicit(&ring->read, read + count, memory_order_release);
+  return count;
+}
+
+// Samples waiting, already out of date by the time it returns
+unsigned ring_used(Ring * ring) {
+  unsigned read = atomic_load_explicit(&ring->read, memory_order_acquire);
+  unsigned write = atomic_load_explicit(&ring->write, memory_order_acquire);
+  return write - read;
+}
@@ -0,0 +1,37 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**
+ * Lock-free ring buffer of samples between exactly one producer thread and
+ * one consumer thread. Each side only ever stores its own index, so neither
+ * can block the other; a full ring takes fewer samples and an empty one
+ * gives fewer back.
+ */
+
+#define RING_CACHE_LINE 64
+
+typedef struct Ring Ring;
+struct Ring {
+  unsigned size; // Power of two
+  float * buffer;
+
+  // Free running, wrapped on access. Padded onto separate cache lines so
+  // the two threads don't bounce one line between them on every update.
+  char padding0[RING_CACHE_LINE];
+  atomic_uint write;
+  char padding1[RING_CACHE_LINE];
+  atomic_uint read;
+  char padding2[RING_CACHE_LINE];
+};
+
+bool ring_init(Ring * ring, unsigned size);
+void ring_deinit(Ring * ring);
+
+unsigned ring_write(Ring * ring, const float * samples, unsigned count);
+unsigned ring_read(Ring * ring, float * samples, unsigned count);
+unsigned ring_used(Ring * ring);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stddef.h>
+#include <limits.h>
+
+#include "scheduler.h"
+
+void scheduler_init(Scheduler * scheduler) {
+  for (int i = 0; i < EVENT_COUNT; ++i) {
+    scheduler->events[i].callback = NULL;
+    scheduler->events[i].data = NULL;
+  }
+  scheduler_reset(scheduler);
+}
+
+// Drop all pending events, the callbacks stay registered
+void scheduler_reset(Scheduler * scheduler) {
+  for (int i = 0; i < EVENT_COUNT; ++i) {
+    scheduler->events[i].time = 0;
+    scheduler->events[i].index = -1;
+  }
+  scheduler->size = 0;
+}
+
+void scheduler_register(Scheduler * scheduler, Event event, EventCallback callback, void * data) {
+  scheduler->events[event].callback = callback;
+  scheduler->events[event].data = data;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int scheduler_time(Scheduler * scheduler, int index) {
+  return scheduler->events[scheduler->heap[index]].time;
+}
+
+static void scheduler_place(Scheduler * scheduler, int index, Event event) {
+  scheduler->heap[index] = event;
+  scheduler->events[event].index = index;
+}
+
+static void scheduler_sift_up(Scheduler * scheduler, int index) {
+  Event event = scheduler->heap[index];
+  int time = scheduler->events[event].time;
+
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    if (scheduler_time(scheduler, parent) <= time) {
+      break;
+    }
+    scheduler_place(scheduler, index, scheduler->heap[parent]);
+    index = parent;
+  }
+  scheduler_place(scheduler, index, event);
+}
+
+static void scheduler_sift_down(Scheduler * scheduler, int index) {
+  Event event = scheduler->heap[index];
+  int time = scheduler->events[event].time;
+
+  while (true) {
+    int child = index * 2 + 1;
+    if (child >= scheduler->size) {
+      break;
+    }
+    if (child + 1 < scheduler->size &&
+        scheduler_time(scheduler, child + 1) < scheduler_time(scheduler, child)) {
+      child++;
+    }
+    if (time <= scheduler_time(scheduler, child)) {
+      break;
+    }
+    scheduler_place(scheduler, index, scheduler->heap[child]);
+    index = child;
+  }
+  scheduler_place(scheduler, index, event);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Schedule an event, moving it if it's already pending
+void scheduler_set(Scheduler * scheduler, Event event, int time) {
+  int index = scheduler->events[event].index;
+  scheduler->events[event].time = time;
+
+  if (index < 0) {
+    index = scheduler->size++;
+    scheduler_place(scheduler, index, event);
+  }
+
+  scheduler_sift_up(scheduler, index);
+  scheduler_sift_down(scheduler, scheduler->events[event].index);
+}
+
+void scheduler_cancel(Scheduler * scheduler, Event event) {
+  int index = scheduler->events[event].index;
+  if (index < 0) {
+    return;
+  }
+
+  scheduler->events[event].index = -1;
+  scheduler->size--;
+
+  if (index != scheduler->size) {
+    scheduler_place(scheduler, index, scheduler->heap[scheduler->size]);
+    scheduler_sift_up(scheduler, index);
+    scheduler_sift_down(scheduler, scheduler->events[scheduler->heap[index]].index);
+  }
+}
+
+bool scheduler_pending(Scheduler * scheduler, Event event) {
+  return scheduler->events[event].index >= 0;
+}
+
+// Time of the earliest pending event, or INT_MAX if there are none
+int scheduler_next(Scheduler * scheduler) {
+  return scheduler->size > 0 ? scheduler_time(scheduler, 0) : INT_MAX;
+}
+
+/**
+ * Run the callbacks of every event due at or before the given time, in order.
+ * An event is no longer pending when its callback runs, so the callback may
+ * schedule it again.
+ */
+void scheduler_dispatch(Scheduler * scheduler, int time) {
+  while (scheduler->size > 0 && scheduler_time(scheduler, 0) <= time) {
+    Event event = scheduler->heap[0];
+    scheduler_cancel(scheduler, event);
+
+    if (scheduler->events[event].callback) {
+      scheduler->events[event].callback(scheduler->events[event].data, scheduler->events[event].time);
+    }
+  }
+}
+
+// Move every event back by some cycles, which leaves the heap in order
+void scheduler_rebase(Scheduler * scheduler, int cycles) {
+  for (int i = 0; i < EVENT_COUNT; ++i) {
+    scheduler->events[i].time -= cycles;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+
+/**
+ * Timestamped events on the CPU clock
+ *
+ * Each component that needs to act at a known time registers the time of
+ * its next event instead of being ticked every cycle. The CPU runs freely
+ * until the earliest pending event, which is kept at the top of a min-heap.
+ * There is one slot per event type, so scheduling an event that is already
+ * pending moves it rather than adding another.
+ */
+
+typedef enum {
+  EVENT_APU_FRAME, // next step of the APU frame counter
+  EVENT_PPU,       // vertical blank, or a scanline the mapper counts
+  EVENT_COUNT
+} Event;
+
+typedef void (*EventCallback)(void * data, int time);
+
+typedef struct Scheduler Scheduler;
+struct Scheduler {
+  struct {
+    int time;
+    int index; // position in the heap, -1 when not pending
+    EventCallback callback;
+    void * data;
+  } events[EVENT_COUNT];
+
+  Event heap[EVENT_COUNT];
+  int size;
+};
+
+void scheduler_init(Scheduler * scheduler);
+void scheduler_reset(Scheduler * scheduler);
+
+void scheduler_register(Scheduler * scheduler, Event event, EventCallback callback, void * data);
+void scheduler_set(Scheduler * scheduler, Event event, int time);
+void scheduler_cancel(Scheduler * scheduler, Event event);
+bool scheduler_pending(Scheduler * scheduler, Event event);
+
+int scheduler_next(Scheduler * scheduler);
+void scheduler_dispatch(Scheduler * scheduler, int time);
+void scheduler_rebase(Scheduler * scheduler, int cycles);
+
+#endif
@@ -6,12 +6,40 @@
 #include <glib.h>
 
 #include "audio.h"
+#include "ring.h"
 
-#define SAMPLE_RATE 44100
+// Must be a power of two, about 190 ms
+#define AUDIO_RING_SIZE 8192
 
+// Latency to aim for, NES_AUDIO_LATENCY overrides it in milliseconds
+#define AUDIO_TARGET_LATENCY 0.003
+
+// Largest change to the output rate, small enough not to hear the pitch move
+#define AUDIO_MAX_RATE_DELTA 0.005
+
+// How quickly the measured fill follows the ring, per frame
+#define AUDIO_FILL_SMOOTHING 0.1
+
+// How quickly a steady difference between the clocks is learned, per frame
+#define AUDIO_DRIFT_GAIN 0.00005
+
+/**
+ * Samples are produced by the emulator a frame at a time and consumed by
+ * PortAudio's callback on its own thread. The callback only drains the
+ * ring, so it never waits on the emulator and can run with a small buffer.
+ */
 struct Audio {
   PaStream * stream;
-  APU * apu;
+  Ring ring;
+  float last; // Repeated when the ring runs dry, callback only
+
+  atomic_ulong underruns; // Callbacks that ran out of samples
+  atomic_ulong overruns;  // Samples dropped because the ring was full
+
+  // Rate control, emulator thread only
+  double target; // Samples left in the ring when the next frame arrives
+  double fill;   // Smoothed measure of the same
+  double drift;  // Learned ratio between the clocks, minus one
 };
 
 static int audio_callback(const void * input_buffer,
@@ -27,15 +55,22 @@ static int audio_callback(const void * input_buffer,
   float * out = (float *)output_buffer;
   Audio * audio = (Audio *)user_data;
 
-  unsigned long i = 0;
-  for (i = 0; i < frames_per_buffer; ++i) {
-    *out++ = apu_sample(audio->apu);
+  unsigned long count = ring_read(&audio->ring, out, frames_per_buffer);
+  if (count > 0) {
+    audio->last = out[count - 1];
+  }
+
+  if (count < frames_per_buffer) {
+    atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+    for (unsigned long i = count; i < frames_per_buffer; ++i) {
+      out[i] = audio->last;
+    }
   }
 
   return 0;
 }
 
-Audio * audio_create(APU * apu) {
+Audio * audio_create(void) {
   PaDeviceIndex device = Pa_GetDefaultOutputDevice();
   if (device == paNoDevice) {
     return NULL;
@@ -46,26 +81,39 @@ Audio * audio_create(APU * apu) {
     .device = device,
     .hostApiSpecificStreamInfo = NULL,
     .sampleFormat = paFloat32,
-    .suggestedLatency = Pa_GetDeviceInfo(device)->defaultHighOutputLatency
+    .suggestedLatency = Pa_GetDeviceInfo(device)->defaultLowOutputLatency
   };
 
-  Audio * audio = g_malloc(sizeof(Audio));
+  Audio * audio = g_malloc0(sizeof(Audio));
   if (!audio) {
     return NULL;
   }
 
-  audio->apu = apu;
+  if (!ring_init(&audio->ring, AUDIO_RING_SIZE)) {
+    g_free(audio);
+    return NULL;
+  }
+
+  atomic_init(&audio->underruns, 0);
+  atomic_init(&audio->overruns, 0);
+
+  const char * latency = g_getenv("NES_AUDIO_LATENCY");
+  double target = latency ? g_ascii_strtod(latency, NULL) / 1000 : AUDIO_TARGET_LATENCY;
+  audio->target = MAX(target, 1.0 / APU_SAMPLE_RATE) * APU_SAMPLE_RATE;
+  audio->fill = audio->target;
+
   PaError err = Pa_OpenStream(&audio->stream,
                               NULL,
                               &output_parameters,
-                              SAMPLE_RATE,
+                              APU_SAMPLE_RATE,
                               paFramesPerBufferUnspecified,
                               paNoFlag,
                               audio_callback,
                               audio);
 
   if (err != paNoError) {
-    free(audio);
+    ring_deinit(&audio->ring);
+    g_free(audio);
     return NULL;
   }
 
@@ -74,9 +122,54 @@ Audio * audio_create(APU * apu) {
 
 void audio_destroy(Audio * audio) {
   Pa_CloseStream(audio->stream);
+  ring_deinit(&audio->ring);
   g_free(audio);
 }
 
+// Queue samples for playback, what doesn't fit is dropped
+void audio_write(Audio * audio, const float * samples, int count) {
+  unsigned written = ring_write(&audio->ring, samples, count);
+  if (written < (unsigned)count) {
+    atomic_fetch_add_explicit(&audio->overruns, count - written, memory_order_relaxed);
+  }
+}
+
+/**
+ * Dynamic rate control
+ *
+ * The emulator is paced by the display and the callback by the sound card,
+ * so the ring slowly fills up or drains unless something gives. Before each
+ * frame is written, the fill left over from the last one is compared to the
+ * target, and the rate to resample the next frame at is nudged by up to
+ * AUDIO_MAX_RATE_DELTA: a little faster when the ring is running low, a
+ * little slower when it's too full. This holds the latency near the target
+ * without letting it drift into underruns.
+ *
+ * On its own that settles wherever the nudge cancels out the difference
+ * between the clocks, so the difference is also learned slowly and
+ * applied on top, which brings the fill back to the target itself.
+ *
+ * Reference: https://docs.libretro.com/development/cores/dynamic-rate-control/
+ */
+double audio_rate(Audio * audio) {
+  audio->fill += (ring_used(&audio->ring) - audio->fill) * AUDIO_FILL_SMOOTHING;
+
+  double error = (audio->target - audio->fill) / audio->target;
+  error = CLAMP(error, -1.0, 1.0);
+
+  audio->drift += AUDIO_DRIFT_GAIN * error;
+  audio->drift = CLAMP(audio->drift, -AUDIO_MAX_RATE_DELTA, AUDIO_MAX_RATE_DELTA);
+
+  double delta = AUDIO_MAX_RATE_DELTA * error + audio->drift;
+  delta = CLAMP(delta, -AUDIO_MAX_RATE_DELTA, AUDIO_MAX_RATE_DELTA);
+  return APU_SAMPLE_RATE * (1 + delta);
+}
+
+void audio_stats(Audio * audio, unsigned long * underruns, unsigned long * overruns) {
+  *underruns = atomic_load_explicit(&audio->underruns, memory_order_relaxed);
+  *overruns = atomic_load_explicit(&audio->overruns, memory_order_relaxed);
+}
+
 int audio_start(Audio * audio) {
   return Pa_StartStream(audio->stream) == paNoError;
 }
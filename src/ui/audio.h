@@ -5,9 +5,12 @@
 
 typedef struct Audio Audio;
 
-Audio * audio_create(APU * apu);
+Audio * audio_create(void);
 void audio_destroy(Audio * audio);
 int audio_start(Audio * audio);
 int audio_stop(Audio * audio);
+void audio_write(Audio * audio, const float * samples, int count);
+double audio_rate(Audio * audio);
+void audio_stats(Audio * audio, unsigned long * underruns, unsigned long * overruns);
 
 #endif
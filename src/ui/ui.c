@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <GLFW/glfw3.h>
 #include <glib.h>
@@ -6,6 +7,7 @@
 #include "ui.h"
 #include "events.h"
 #include "clock.h"
+#include "array.h"
 
 #define SCALE 4
 #define WINDOW_WIDTH 256 * SCALE
@@ -15,13 +17,38 @@
 void ui_init(UI * ui) {
   nes_init(&ui->nes);
   video_init(&ui->video);
-  ui->audio = audio_create(&ui->nes.apu);
+  ui->audio = audio_create();
 }
 
 void ui_deinit(UI * ui) {
   if (ui->audio) {
+    unsigned long underruns, overruns;
+    audio_stats(ui->audio, &underruns, &overruns);
+    if (underruns || overruns) {
+      fprintf(stderr, "Audio: %lu underruns, %lu samples dropped\n", underruns, overruns);
+    }
     audio_destroy(ui->audio);
   }
+  nes_deinit(&ui->nes);
+}
+
+// Hand the sound of the last frame to the audio stream, and pick the rate
+// the next one is resampled at
+static void ui_audio(UI * ui) {
+  float samples[1024];
+  APU * apu = &ui->nes.apu;
+
+  apu_end_frame(apu);
+  if (ui->audio) {
+    apu_set_sample_rate(apu, audio_rate(ui->audio));
+  }
+
+  int count;
+  while ((count = apu_read_samples(apu, samples, ARRAY_LENGTH(samples))) > 0) {
+    if (ui->audio) {
+      audio_write(ui->audio, samples, count);
+    }
+  }
 }
 
 int ui_run(UI * ui, Cartridge * cartridge) {
@@ -46,31 +73,20 @@ int ui_run(UI * ui, Cartridge * cartridge) {
   }
 
   int render_clock = 0;
-  int apu_timer = 0;
-  
+  int cpu_target = 0;
+
   while (!glfwWindowShouldClose(window)) {
-    int cpu_cycles = frequency_scale(CPU_FREQUENCY / FRAME_RATE, render_clock);
-    while (cpu_cycles-- != 0) {
-      cpu_next_instr(&ui->nes.cpu);
-      
-      int ppu_cycles = 3;
-      while (ppu_cycles-- != 0) {
-        /* ppu_tick(&ui->nes.ppu); */
-      }
-
-      if (apu_timer != 0) {
-        apu_timer--;
-      } else {
-        apu_timer = 1;
-        apu_tick(&ui->nes.apu);
-      }
-    }
+    cpu_target += frequency_scale(CPU_FREQUENCY / FRAME_RATE, render_clock);
+    nes_run(&ui->nes, cpu_target);
+    ui_audio(ui);
+    cartridge_sync_save(cartridge);
+    cpu_target -= nes_rebase(&ui->nes);
 
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
     glViewport(0, 0, width, height);
 
-    video_render(&ui->video);
+    video_render(&ui->video, nes_framebuffer(&ui->nes), nes_emphasis(&ui->nes));
 
     glfwSwapBuffers(window);
     glfwPollEvents();
@@ -80,7 +96,8 @@ int ui_run(UI * ui, Cartridge * cartridge) {
   if (ui->audio) {
     audio_stop(ui->audio);
   }
-  
+
+  video_deinit(&ui->video);
   glfwDestroyWindow(window);
   return 1;
 }
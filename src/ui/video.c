@@ -1,21 +1,95 @@
+#include <string.h>
+
 #include <GLFW/glfw3.h>
 
 #include "video.h"
 
+/**
+ * RGB of each palette index, as the 2C02 is commonly measured
+ *
+ * Reference: http://wiki.nesdev.com/w/index.php/PPU_palettes
+ */
+static const uint8_t video_palette[64][3] = {
+  { 84,  84,  84}, {  0,  30, 116}, {  8,  16, 144}, { 48,   0, 136},
+  { 68,   0, 100}, { 92,   0,  48}, { 84,   4,   0}, { 60,  24,   0},
+  { 32,  42,   0}, {  8,  58,   0}, {  0,  64,   0}, {  0,  60,   0},
+  {  0,  50,  60}, {  0,   0,   0}, {  0,   0,   0}, {  0,   0,   0},
+  {152, 150, 152}, {  8,  76, 196}, { 48,  50, 236}, { 92,  30, 228},
+  {136,  20, 176}, {160,  20, 100}, {152,  34,  32}, {120,  60,   0},
+  { 84,  90,   0}, { 40, 114,   0}, {  8, 124,   0}, {  0, 118,  40},
+  {  0, 102, 120}, {  0,   0,   0}, {  0,   0,   0}, {  0,   0,   0},
+  {236, 238, 236}, { 76, 154, 236}, {120, 124, 236}, {176,  98, 236},
+  {228,  84, 236}, {236,  88, 180}, {236, 106, 100}, {212, 136,  32},
+  {160, 170,   0}, {116, 196,   0}, { 76, 208,  32}, { 56, 204, 108},
+  { 56, 180, 204}, { 60,  60,  60}, {  0,   0,   0}, {  0,   0,   0},
+  {236, 238, 236}, {168, 204, 236}, {188, 188, 236}, {212, 178, 236},
+  {236, 174, 236}, {236, 174, 212}, {236, 180, 176}, {228, 196, 144},
+  {204, 210, 120}, {180, 222, 120}, {168, 226, 144}, {152, 226, 180},
+  {160, 214, 228}, {160, 162, 160}, {  0,   0,   0}, {  0,   0,   0}
+};
+
+// How much each emphasis bit dims the other two channels
+#define VIDEO_EMPHASIS_DIM 0.816
+
 void video_init(Video * video) {
-  (void)video;
+  video->texture = 0;
+
+  for (int emphasis = 0; emphasis < 8; ++emphasis) {
+    for (int index = 0; index < 64; ++index) {
+      for (int channel = 0; channel < 3; ++channel) {
+        double value = video_palette[index][channel];
+        for (int bit = 0; bit < 3; ++bit) {
+          if ((emphasis >> bit & 1) && bit != channel) {
+            value *= VIDEO_EMPHASIS_DIM;
+          }
+        }
+        video->palette[emphasis][index][channel] = value + 0.5;
+      }
+      video->palette[emphasis][index][3] = 255;
+    }
+  }
 }
 
-void video_render(Video * video) {
-  (void)video;
+// Call while the context the frames were drawn with is still current
+void video_deinit(Video * video) {
+  if (video->texture) {
+    glDeleteTextures(1, &video->texture);
+    video->texture = 0;
+  }
+}
+
+/**
+ * Draw a frame of palette indices from the PPU over the whole viewport,
+ * with the emphasis bits of each line
+ */
+void video_render(Video * video, const uint8_t * frame, const uint8_t * emphasis) {
+  for (int y = 0; y < PPU_HEIGHT; ++y) {
+    const uint8_t (*palette)[4] = video->palette[emphasis[y] & 7];
+    for (int x = 0; x < PPU_WIDTH; ++x) {
+      memcpy(video->pixels[y][x], palette[frame[y * PPU_WIDTH + x] & 0x3F], 4);
+    }
+  }
+
+  glEnable(GL_TEXTURE_2D);
+  if (!video->texture) {
+    glGenTextures(1, &video->texture);
+    glBindTexture(GL_TEXTURE_2D, video->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PPU_WIDTH, PPU_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, video->pixels);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, video->texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PPU_WIDTH, PPU_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, video->pixels);
+  }
 
   glClear(GL_COLOR_BUFFER_BIT);
   glLoadIdentity();
 
+  // Row 0 is the top of the picture
   glBegin(GL_QUADS);
-  glVertex2f(-0.5f, -0.5f);
-  glVertex2f(-0.5f, 0.5f);
-  glVertex2f(0.5f, 0.5f);
-  glVertex2f(0.5f, -0.5f);
+  glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, -1.0f);
+  glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, 1.0f);
+  glTexCoord2f(1.0f, 0.0f); glVertex2f(1.0f, 1.0f);
+  glTexCoord2f(1.0f, 1.0f); glVertex2f(1.0f, -1.0f);
   glEnd();
 }
@@ -1,12 +1,19 @@
 #ifndef RENDER_H
 #define RENDER_H
 
+#include <stdint.h>
+
+#include "ppu/ppu.h"
+
 typedef struct Video Video;
 struct Video {
-  /* PPU * ppu; */
+  unsigned int texture; // Created on the first frame, once there is a context
+  uint8_t palette[8][64][4]; // RGBA of each index, for each set of emphasis bits
+  uint8_t pixels[PPU_HEIGHT][PPU_WIDTH][4];
 };
 
 void video_init(Video * video);
-void video_render(Video * video);
+void video_deinit(Video * video);
+void video_render(Video * video, const uint8_t * frame, const uint8_t * emphasis);
 
 #endif